@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <process_bridge.h>
+
+// The whole suite, as one JSON document on stdout for tracking regressions:
+// echo throughput from 8 B to 16 MB, 8 B round-trip latency percentiles,
+// spawn and despawn latency, and event loop scaling from 1 to 512 children.
+// --quick shortens every run. Event loops honour PB_LOOP_BACKEND.
+
+#ifdef _WIN32
+
+int main()
+{
+    printf("{\"error\": \"this suite needs the event loop, it does not run on Windows\"}\n");
+    return 0;
+}
+
+#else
+
+#include <time.h>
+#include <sys/resource.h>
+
+#define ECHO_COMMAND "../bin/bench_process_bridge_child echo"
+#define READY_COMMAND "../bin/bench_process_bridge_child ready"
+#define PAYLOAD_MAX ((size_t)16 << 20)
+#define IN_FLIGHT_BYTES 32768 // less than a pipe holds: neither side blocks on a full pipe
+#define SCALING_PAYLOAD 64
+
+typedef struct
+{
+    double budget_s;       // per throughput size and per scaling step
+    size_t latency_samples;
+    size_t spawn_samples;
+} settings_t;
+
+typedef struct
+{
+    const char *payload;
+    size_t messages;
+    bool stopping;
+    size_t in_flight;
+} scaling_t;
+
+static char payload[PAYLOAD_MAX];
+static char mailbox[PAYLOAD_MAX];
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t count, double p)
+{
+    size_t index = (size_t)(p * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+// Prints "name": {samples, percentiles in microseconds}, sorting samples.
+static void print_distribution(const char *name, double *samples, size_t count, const char *suffix)
+{
+    qsort(samples, count, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += samples[i];
+    }
+    printf("  \"%s\": {\"samples\": %zu, \"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"min\": %.2f, \"max\": %.2f}%s\n",
+           name, count, sum / (double)count, percentile(samples, count, 0.5), percentile(samples, count, 0.99),
+           percentile(samples, count, 0.999), samples[0], samples[count - 1], suffix);
+}
+
+static PB_process_t *spawn_echo(void)
+{
+    PB_process_t *child = PB_create_framed(PB_TYPE_CHILD, PB_FRAMING_LENGTH_PREFIXED);
+    if (NULL == child || PB_STATUS_OK != PB_spawn(child, ECHO_COMMAND))
+    {
+        fprintf(stderr, "spawn failed: %s\n", NULL == child ? "out of memory" : child->error);
+        PB_destroy(child);
+        return NULL;
+    }
+    return child;
+}
+
+// An empty frame ends the echo loop.
+static void stop_echo(PB_process_t *child)
+{
+    PB_send_bytes(child, payload, 0);
+    PB_wait(child);
+    PB_destroy(child);
+}
+
+// Echoes windows of messages, as many as fit in IN_FLIGHT_BYTES, for budget_s.
+static int throughput(PB_process_t *child, size_t size, double budget_s, const char *suffix)
+{
+    size_t window = IN_FLIGHT_BYTES / (size + sizeof(PB_frame_header_t));
+    window = window < 1 ? 1 : (window > 64 ? 64 : window);
+
+    size_t messages = 0;
+    double start = now_s();
+    double elapsed = 0;
+    do
+    {
+        for (size_t i = 0; i < window; i++)
+        {
+            if (PB_STATUS_OK != PB_send_bytes(child, payload, size))
+            {
+                fprintf(stderr, "send of %zu bytes failed: %s\n", size, child->error);
+                return 1;
+            }
+        }
+        for (size_t i = 0; i < window; i++)
+        {
+            size_t length = 0;
+            if (PB_STATUS_OK != PB_receive_bytes(child, mailbox, sizeof(mailbox), &length) || size != length)
+            {
+                fprintf(stderr, "echo of %zu bytes failed: %s\n", size, child->error);
+                return 1;
+            }
+        }
+        messages += window;
+        elapsed = now_s() - start;
+    } while (elapsed < budget_s);
+
+    printf("    {\"payload_bytes\": %zu, \"window\": %zu, \"messages\": %zu, \"seconds\": %.4f, \"messages_per_s\": %.1f, \"mb_per_s\": %.2f}%s\n",
+           size, window, messages, elapsed, (double)messages / elapsed, (double)(messages * size) / elapsed / 1e6, suffix);
+    return 0;
+}
+
+// Lock-step round trips of 8 bytes.
+static int round_trips(PB_process_t *child, size_t samples)
+{
+    double *latencies = (double *)malloc(samples * sizeof(double));
+    if (NULL == latencies)
+    {
+        return 1;
+    }
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        size_t length = 0;
+        double start = now_s();
+        if (PB_STATUS_OK != PB_send_bytes(child, payload, 8) || PB_STATUS_OK != PB_receive_bytes(child, mailbox, sizeof(mailbox), &length))
+        {
+            fprintf(stderr, "round trip failed: %s\n", child->error);
+            free(latencies);
+            return 1;
+        }
+        latencies[i] = (now_s() - start) * 1e6;
+    }
+    print_distribution("round_trip_8b_us", latencies, samples, ",");
+    free(latencies);
+    return 0;
+}
+
+// PB_spawn until the first line arrives, then PB_despawn of the running child.
+static int spawn_despawn(size_t samples)
+{
+    double *spawns = (double *)malloc(samples * sizeof(double));
+    double *despawns = (double *)malloc(samples * sizeof(double));
+    if (NULL == spawns || NULL == despawns)
+    {
+        free(spawns);
+        free(despawns);
+        return 1;
+    }
+
+    char line[64];
+    for (size_t i = 0; i < samples; i++)
+    {
+        PB_process_t *child = PB_create(PB_TYPE_CHILD);
+        double start = now_s();
+        if (PB_STATUS_OK != PB_spawn(child, READY_COMMAND) || PB_STATUS_OK != PB_receive(child, line, sizeof(line)))
+        {
+            fprintf(stderr, "spawn %zu failed: %s\n", i, child->error);
+            PB_destroy(child);
+            free(spawns);
+            free(despawns);
+            return 1;
+        }
+        spawns[i] = (now_s() - start) * 1e6;
+        start = now_s();
+        PB_despawn(child);
+        despawns[i] = (now_s() - start) * 1e6;
+        PB_destroy(child);
+    }
+    print_distribution("spawn_us", spawns, samples, ",");
+    print_distribution("despawn_us", despawns, samples, ",");
+    free(spawns);
+    free(despawns);
+    return 0;
+}
+
+static void on_scaling_event(PB_loop_t *loop, PB_process_t *process, PB_event_t event, const char *data, size_t length, void *user_data)
+{
+    (void)data;
+    (void)length;
+    scaling_t *scaling = (scaling_t *)user_data;
+    if (PB_EVENT_MESSAGE == event)
+    {
+        scaling->messages++;
+        if (scaling->stopping)
+        {
+            scaling->in_flight--;
+        }
+        else
+        {
+            PB_try_send_bytes(process, scaling->payload, SCALING_PAYLOAD);
+        }
+    }
+    else if (PB_EVENT_CLOSED == event)
+    {
+        PB_loop_remove(loop, process);
+    }
+}
+
+// children echo children, one message in flight each, served by one loop.
+static int scaling_step(size_t n_children, double budget_s, const char *suffix)
+{
+    PB_process_t **children = (PB_process_t **)calloc(n_children, sizeof(PB_process_t *));
+    PB_loop_t *loop = PB_loop_create();
+    scaling_t scaling = {.payload = payload, .messages = 0, .stopping = false, .in_flight = n_children};
+    int error = NULL == children || NULL == loop;
+    for (size_t i = 0; !error && i < n_children; i++)
+    {
+        children[i] = spawn_echo();
+        error = NULL == children[i] || PB_STATUS_OK != PB_loop_add(loop, children[i], on_scaling_event, &scaling);
+    }
+
+    double elapsed = 0;
+    if (!error)
+    {
+        double start = now_s();
+        for (size_t i = 0; i < n_children; i++)
+        {
+            PB_try_send_bytes(children[i], payload, SCALING_PAYLOAD);
+        }
+        while (elapsed < budget_s)
+        {
+            PB_loop_run_once(loop, 100);
+            elapsed = now_s() - start;
+        }
+        scaling.stopping = true;
+        while (scaling.in_flight > 0 && PB_STATUS_OK == PB_loop_run_once(loop, 1000))
+        {
+        }
+        printf("    {\"children\": %zu, \"loop_backend\": \"%s\", \"messages\": %zu, \"seconds\": %.4f, \"messages_per_s\": %.1f}%s\n", n_children,
+               PB_LOOP_BACKEND_IO_URING == PB_loop_backend(loop) ? "io_uring" : "epoll", scaling.messages, elapsed, (double)scaling.messages / elapsed, suffix);
+    }
+
+    for (size_t i = 0; NULL != children && i < n_children; i++)
+    {
+        if (NULL != children[i])
+        {
+            PB_loop_remove(loop, children[i]);
+            PB_set_nonblocking(children[i], false);
+            stop_echo(children[i]);
+        }
+    }
+    PB_loop_destroy(loop);
+    free(children);
+    return error;
+}
+
+int main(int argc, char **argv)
+{
+    bool quick = argc > 1 && 0 == strcmp(argv[1], "--quick");
+    settings_t settings = {.budget_s = 0.5, .latency_samples = 100000, .spawn_samples = 500};
+    if (quick)
+    {
+        settings = (settings_t){.budget_s = 0.05, .latency_samples = 5000, .spawn_samples = 50};
+    }
+
+    // 512 children hold 1536 pipe ends.
+    struct rlimit files;
+    if (0 == getrlimit(RLIMIT_NOFILE, &files))
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    memset(payload, 'p', sizeof(payload));
+
+    PB_process_t *child = spawn_echo();
+    if (NULL == child)
+    {
+        return 1;
+    }
+
+    const size_t sizes[] = {8, 64, 512, 4 << 10, 32 << 10, 256 << 10, 2 << 20, 16 << 20};
+    const size_t n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    printf("{\n  \"quick\": %s,\n  \"throughput\": [\n", quick ? "true" : "false");
+    for (size_t i = 0; i < n_sizes; i++)
+    {
+        if (throughput(child, sizes[i], settings.budget_s, i + 1 < n_sizes ? "," : ""))
+        {
+            return 1;
+        }
+    }
+    printf("  ],\n");
+    if (round_trips(child, settings.latency_samples))
+    {
+        return 1;
+    }
+    stop_echo(child);
+
+    if (spawn_despawn(settings.spawn_samples))
+    {
+        return 1;
+    }
+
+    printf("  \"scaling\": [\n");
+    for (size_t n_children = 1; n_children <= 512; n_children *= 2)
+    {
+        if (scaling_step(n_children, settings.budget_s, n_children < 512 ? "," : ""))
+        {
+            return 1;
+        }
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <process_bridge.h>
+
+#define REPLY_SIZE_MAX (1 << 20)
+#define ECHO_SIZE_MAX ((size_t)16 << 20)
+
+// Answers each "<n>" line with a line of n bytes, until "exit".
+static int reply(void)
+{
+    static char request[64];
+    static char line[REPLY_SIZE_MAX + 1];
+    memset(line, 'r', REPLY_SIZE_MAX);
+    PB_process_t *parent = PB_create(PB_TYPE_PARENT);
+
+    while (PB_STATUS_OK == PB_receive(parent, request, sizeof(request)) && 0 != strcmp(request, "exit"))
+    {
+        size_t size = strtoul(request, NULL, 10);
+        size = size > REPLY_SIZE_MAX ? REPLY_SIZE_MAX : size;
+        line[size] = '\0';
+        PB_send(parent, line);
+        line[size] = 'r';
+    }
+
+    PB_destroy(parent);
+    return 0;
+}
+
+// Says "ready" as soon as it runs, then waits for "exit".
+static int ready(void)
+{
+    char request[64];
+    PB_process_t *parent = PB_create(PB_TYPE_PARENT);
+    PB_send(parent, "ready");
+    while (PB_STATUS_OK == PB_receive(parent, request, sizeof(request)) && 0 != strcmp(request, "exit"))
+    {
+    }
+    PB_destroy(parent);
+    return 0;
+}
+
+// Sends every frame back as it came, until an empty frame.
+static int echo(void)
+{
+    static char frame[ECHO_SIZE_MAX];
+    size_t length = 0;
+    PB_process_t *parent = PB_create_framed(PB_TYPE_PARENT, PB_FRAMING_LENGTH_PREFIXED);
+    while (PB_STATUS_OK == PB_receive_bytes(parent, frame, sizeof(frame), &length) && length > 0)
+    {
+        PB_send_bytes(parent, frame, length);
+    }
+    PB_destroy(parent);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && 0 == strcmp(argv[1], "reply"))
+    {
+        return reply();
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "ready"))
+    {
+        return ready();
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "echo"))
+    {
+        return echo();
+    }
+    fprintf(stderr, "usage: %s reply|ready|echo\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <process_bridge.h>
+
+// Throughput and context switches of lock-step replies from 1 KB to 1 MB,
+// with the default pipe capacity and with 1 MB pipes.
+
+#ifdef _WIN32
+
+int main()
+{
+    printf("This benchmark needs getrusage(), it does not run on Windows.\n");
+    return 0;
+}
+
+#else
+
+#include <time.h>
+#include <sys/resource.h>
+
+#define REPLY_COMMAND "../bin/bench_process_bridge_child reply"
+#define BYTES_PER_RUN ((size_t)32 << 20)
+#define PIPE_SIZE_LARGE ((size_t)1 << 20)
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long context_switches(int who)
+{
+    struct rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+// Returns 0 on success, prints one table row.
+static int run(size_t reply_size, size_t pipe_size)
+{
+    static char mailbox[(1 << 20) + 2]; // room for the newline: no split at exactly 1 MB
+    size_t replies = BYTES_PER_RUN / reply_size;
+    char request[32];
+    snprintf(request, sizeof(request), "%zu", reply_size);
+
+    PB_spawn_options_t options = {.stdin_pipe_size = pipe_size, .stdout_pipe_size = pipe_size};
+    PB_process_t *child = PB_create(PB_TYPE_CHILD);
+    if (PB_STATUS_OK != PB_spawn_with_options(child, REPLY_COMMAND, &options))
+    {
+        fprintf(stderr, "spawn failed: %s\n", child->error);
+        PB_destroy(child);
+        return 1;
+    }
+
+    long self_before = context_switches(RUSAGE_SELF);
+    long children_before = context_switches(RUSAGE_CHILDREN);
+    double start = now_s();
+    for (size_t i = 0; i < replies; i++)
+    {
+        PB_send(child, request);
+        if (PB_STATUS_OK != PB_receive(child, mailbox, sizeof(mailbox)) || reply_size != strlen(mailbox))
+        {
+            fprintf(stderr, "bad reply: %s\n", child->error);
+            PB_despawn(child);
+            PB_wait(child);
+            PB_destroy(child);
+            return 1;
+        }
+    }
+    double elapsed = now_s() - start;
+    PB_send(child, "exit");
+    PB_wait(child);
+    long switches = context_switches(RUSAGE_SELF) - self_before + context_switches(RUSAGE_CHILDREN) - children_before;
+    PB_destroy(child);
+
+    printf("%10zu %10s %8zu %10.1f %12.2f\n", reply_size, 0 == pipe_size ? "default" : "1M", replies,
+           (double)(replies * reply_size) / elapsed / 1e6, (double)switches / (double)replies);
+    return 0;
+}
+
+int main()
+{
+    const size_t reply_sizes[] = {1 << 10, 4 << 10, 16 << 10, 64 << 10, 256 << 10, 1 << 20};
+    const size_t pipe_sizes[] = {0, PIPE_SIZE_LARGE};
+
+    printf("%10s %10s %8s %10s %12s\n", "reply", "pipe", "replies", "MB/s", "ctxsw/reply");
+    for (size_t i = 0; i < sizeof(reply_sizes) / sizeof(reply_sizes[0]); i++)
+    {
+        for (size_t j = 0; j < sizeof(pipe_sizes) / sizeof(pipe_sizes[0]); j++)
+        {
+            if (run(reply_sizes[i], pipe_sizes[j]))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+#endif
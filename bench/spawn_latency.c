@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <process_bridge.h>
+
+// Spawn-to-first-message latency: PB_spawn until the child's first line is
+// received, over runs of 1, 100 and 1000 spawns (each child is torn down
+// before the next one starts).
+
+#ifdef _WIN32
+#include <windows.h>
+#define READY_COMMAND "../bin/bench_process_bridge_child.exe ready"
+
+static double now_us(void)
+{
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * 1e6 / (double)frequency.QuadPart;
+}
+#else
+#include <time.h>
+#define READY_COMMAND "../bin/bench_process_bridge_child ready"
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+#endif
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t count, double p)
+{
+    size_t index = (size_t)(p * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+// Returns 0 on success, prints one table row.
+static int run(size_t spawns)
+{
+    double *latencies = (double *)malloc(spawns * sizeof(double));
+    if (NULL == latencies)
+    {
+        return 1;
+    }
+
+    char mailbox[64];
+    for (size_t i = 0; i < spawns; i++)
+    {
+        PB_process_t *child = PB_create(PB_TYPE_CHILD);
+        double start = now_us();
+        if (PB_STATUS_OK != PB_spawn(child, READY_COMMAND) ||
+            PB_STATUS_OK != PB_receive(child, mailbox, sizeof(mailbox)) || 0 != strcmp(mailbox, "ready"))
+        {
+            fprintf(stderr, "spawn %zu failed: %s\n", i, child->error);
+            PB_destroy(child);
+            free(latencies);
+            return 1;
+        }
+        latencies[i] = now_us() - start;
+        PB_send(child, "exit");
+        PB_wait(child);
+        PB_destroy(child);
+    }
+
+    qsort(latencies, spawns, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (size_t i = 0; i < spawns; i++)
+    {
+        sum += latencies[i];
+    }
+    printf("%8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n", spawns, sum / (double)spawns, percentile(latencies, spawns, 0.5),
+           percentile(latencies, spawns, 0.99), latencies[0], latencies[spawns - 1]);
+    free(latencies);
+    return 0;
+}
+
+int main()
+{
+    const size_t runs[] = {1, 100, 1000};
+
+    printf("%8s %10s %10s %10s %10s %10s\n", "spawns", "mean_us", "p50_us", "p99_us", "min_us", "max_us");
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++)
+    {
+        if (run(runs[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
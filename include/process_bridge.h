@@ -30,8 +30,46 @@ typedef enum
     PB_STATUS_TERMINATED,
     PB_STATUS_GENERIC_ERROR,
     PB_STATUS_USAGE_ERROR,
+    PB_STATUS_TIMEOUT,
+    PB_STATUS_WOULD_BLOCK,
 } PB_status_t;
 
+typedef enum
+{
+    PB_FRAMING_TEXT = 0,             // newline-terminated strings
+    PB_FRAMING_LENGTH_PREFIXED = 1,  // PB_frame_header_t followed by length bytes
+} PB_framing_t;
+
+typedef enum
+{
+    PB_TRANSPORT_PIPE = 0,          // stdin/stdout pipes
+    PB_TRANSPORT_SHARED_MEMORY = 1, // memfd rings next to the pipes (Linux only)
+} PB_transport_t;
+
+typedef enum
+{
+    PB_FLUSH_IMMEDIATE = 0, // every send is written right away
+    PB_FLUSH_COALESCE = 1,  // sends pile up until PB_flush, a full buffer or a receive
+} PB_flush_policy_t;
+
+// Header preceding every message on stdin/stdout of a framed process.
+// stderr always stays newline-terminated text.
+typedef struct
+{
+    uint32_t length;
+    uint32_t flags;
+} PB_frame_header_t;
+
+#define PB_FRAME_LENGTH_MAX UINT32_MAX
+#define PB_FRAME_FLAG_TAGGED 0x1u // payload starts with a uint64_t request id
+
+// A message left in place inside the library's receive buffer.
+typedef struct
+{
+    const char *data;
+    size_t length;
+} PB_message_view_t;
+
 #ifdef _WIN32
 typedef DWORD PB_return_t;
 #else
@@ -40,9 +78,18 @@ typedef uint8_t PB_return_t;
 
 static const PB_return_t PB_DEFAULT_RETURN = 0xFF;
 
+typedef struct PB_buffer_t PB_buffer_t;
+typedef struct PB_requests_t PB_requests_t;
+typedef struct PB_shm_t PB_shm_t;
+typedef struct PB_zygote_t PB_zygote_t;
+typedef struct PB_drain_t PB_drain_t;
+typedef struct PB_async_t PB_async_t;
+
 typedef struct PB_process_t
 {
     PB_type_t type;
+    PB_framing_t framing;
+    PB_transport_t transport;
     PB_status_t status;
     char error[PB_STRING_SIZE_DEFAULT];
     PB_return_t return_code;
@@ -53,26 +100,100 @@ typedef struct PB_process_t
     HANDLE stderr_h;
 #else
     pid_t pid;
+    int pidfd;
+    bool reaped;
     int stdin_fd;
     int stdout_fd;
     int stderr_fd;
 #endif
+    bool nonblocking;
+    bool loop_reads; // its pipes are read by an io_uring loop
+    PB_flush_policy_t flush_policy;
+    PB_buffer_t *receive_buffer;
+    PB_buffer_t *receive_err_buffer;
+    PB_buffer_t *send_buffer;
+    PB_requests_t *requests;
+    bool retain_requests; // request payloads kept for a supervisor's handback
+    PB_shm_t *shm;
+    PB_zygote_t *zygote; // forked by this zygote, which reaps it
+    size_t stderr_ring_lines;
+    PB_drain_t *stderr_drain;
+    PB_async_t *async;
 } PB_process_t;
 
+// Spawn-time tuning, zero fields keep the defaults.
+typedef struct
+{
+    size_t stdin_pipe_size;  // pipe capacity in bytes (F_SETPIPE_SZ on Linux,
+    size_t stdout_pipe_size; // buffer size hint on Windows)
+    size_t stderr_pipe_size;
+    size_t ring_size;        // per direction, PB_TRANSPORT_SHARED_MEMORY only
+} PB_spawn_options_t;
+
 // -----------------------------------------------------------------------------
 // Create / Destroy functions
 // -----------------------------------------------------------------------------
 
 PB_process_t *PB_create(PB_type_t);
+PB_process_t *PB_create_framed(PB_type_t, PB_framing_t);
 void PB_destroy(PB_process_t *);
 
 // -----------------------------------------------------------------------------
 // Process life management
 // -----------------------------------------------------------------------------
 
+// The program is searched in PATH when it has no slash. On Unix the child
+// only inherits its standard streams (and the shared memory rings): every
+// other fd is closed.
 PB_status_t PB_spawn(PB_process_t *, const char *);
+// NULL options are the same as PB_spawn. Linux may refuse a pipe size above
+// /proc/sys/fs/pipe-max-size to unprivileged processes: the spawn then fails.
+PB_status_t PB_spawn_with_options(PB_process_t *, const char *, const PB_spawn_options_t *);
+// Kills the child. On Unix it is reaped in the background: return_code is
+// PB_DEFAULT_RETURN (unless it had already exited) and PB_wait returns at once.
 PB_status_t PB_despawn(PB_process_t *);
 PB_status_t PB_wait(PB_process_t *);
+// Same as PB_wait, giving up with PB_STATUS_TIMEOUT after timeout_ms
+// (negative waits forever). Once reaped, return_code is kept and every later
+// wait returns PB_STATUS_OK at once.
+PB_status_t PB_wait_timeout(PB_process_t *, int timeout_ms);
+// PB_STATUS_OK with return_code set if the child exited, else PB_STATUS_WOULD_BLOCK.
+PB_status_t PB_poll_exit(PB_process_t *);
+// Readable with poll()/epoll once the child exited (its pidfd, Linux 5.3+),
+// -1 where there is none. Reap it with PB_poll_exit.
+int PB_exit_fd(const PB_process_t *);
+
+// Puts the pipes of a child in O_NONBLOCK mode (now or at spawn time), which
+// enables PB_try_send. Not available on Windows.
+PB_status_t PB_set_nonblocking(PB_process_t *, bool);
+
+// With PB_FLUSH_COALESCE, stdin (or stdout, in a child) messages gather in
+// the process's outbound buffer and are written together once it holds
+// PB_COALESCE_SIZE bytes, on PB_flush, before any receive that has to read
+// (so request/response code cannot deadlock). PB_destroy only writes what
+// the pipe takes without blocking and drops the rest: PB_flush before it.
+// stderr is never delayed. Switching back to PB_FLUSH_IMMEDIATE flushes.
+// Not available on Windows.
+#define PB_COALESCE_SIZE 65536
+PB_status_t PB_set_flush_policy(PB_process_t *, PB_flush_policy_t);
+
+// Chooses how stdin/stdout data travel, before PB_spawn. With shared memory
+// the messages go through a ring buffer per direction and the pipes stay for
+// stderr and for detecting the end of the child; PB_send/PB_receive work the
+// same on both sides. The child must be a process_bridge program, which
+// attaches in PB_create. If the rings cannot be created PB_spawn falls back
+// to pipes: transport tells what is in use.
+PB_status_t PB_set_transport(PB_process_t *, PB_transport_t);
+
+// Opt-in: a helper thread drains the child's stderr as soon as anything
+// arrives and keeps its last max_lines lines (older ones are dropped), so a
+// child logging a lot never blocks on a full stderr pipe while nobody calls
+// PB_receive_err, which then reads from that ring. Set before or after
+// PB_spawn; 0 stops draining and discards the ring. An event loop leaves the
+// stderr of such a child alone. Not available on Windows.
+PB_status_t PB_set_stderr_ring(PB_process_t *child, size_t max_lines);
+// Lines dropped because the ring was full.
+size_t PB_stderr_dropped(const PB_process_t *child);
 
 // -----------------------------------------------------------------------------
 // Process communications
@@ -83,8 +204,297 @@ PB_status_t PB_send_err(PB_process_t *, const char *message);
 PB_status_t PB_receive(PB_process_t *, char *mailbox, size_t);
 PB_status_t PB_receive_err(PB_process_t *, char *mailbox, size_t);
 
+// Same as above, giving up with PB_STATUS_TIMEOUT after timeout_ms (negative
+// waits forever). A partially received message stays buffered for the next call.
+PB_status_t PB_receive_timeout(PB_process_t *, char *mailbox, size_t, int timeout_ms);
+PB_status_t PB_receive_err_timeout(PB_process_t *, char *mailbox, size_t, int timeout_ms);
+
+// Sends count messages with as few writev() calls as possible.
+PB_status_t PB_send_batch(PB_process_t *, const char **messages, size_t count);
+
+// Binary messages, only for processes created with PB_FRAMING_LENGTH_PREFIXED.
+// If the next frame is larger than size, *length is set to its size, nothing
+// is consumed and PB_STATUS_GENERIC_ERROR is returned.
+PB_status_t PB_send_bytes(PB_process_t *, const void *data, size_t length);
+PB_status_t PB_receive_bytes(PB_process_t *, void *mailbox, size_t size, size_t *length);
+PB_status_t PB_receive_bytes_timeout(PB_process_t *, void *mailbox, size_t size, size_t *length, int timeout_ms);
+PB_status_t PB_send_bytes_batch(PB_process_t *, const void *const *data, const size_t *lengths, size_t count);
+
+// Non-blocking variants returning PB_STATUS_WOULD_BLOCK instead of waiting.
+// A try send always accepts the message: what the pipe cannot take now is
+// queued (PB_STATUS_WOULD_BLOCK) and written by the next send or PB_flush.
+PB_status_t PB_try_send(PB_process_t *, const char *message);
+PB_status_t PB_try_send_bytes(PB_process_t *, const void *data, size_t length);
+PB_status_t PB_try_receive(PB_process_t *, char *mailbox, size_t);
+PB_status_t PB_try_receive_bytes(PB_process_t *, void *mailbox, size_t size, size_t *length);
+PB_status_t PB_flush(PB_process_t *);
+
+// Raw bytes for large inputs: on text processes they are sent as they are
+// (the file already holds newline-terminated lines), on framed processes
+// they form one frame. Blocking, after whatever is queued. Not available
+// on Windows.
+// PB_send_file moves length bytes of fd from offset (negative: the current
+// position) with splice(), without copying them through user space.
+PB_status_t PB_send_file(PB_process_t *, int fd, int64_t offset, size_t length);
+// PB_send_pages maps page-aligned memory into the pipe with vmsplice(): the
+// pages must stay unmodified until the peer has read them.
+PB_status_t PB_send_pages(PB_process_t *, const void *data, size_t length);
+
+// Returns every complete message already buffered, reading at most once (and
+// only if none is buffered yet); *count may be 0. Views point into the receive
+// buffer and stay valid until the next receive call on the same process.
+// Text views are NUL-terminated, frame views are not.
+PB_status_t PB_receive_many(PB_process_t *, PB_message_view_t *views, size_t max_views, size_t *count);
+
+// -----------------------------------------------------------------------------
+// Request pipelining
+// -----------------------------------------------------------------------------
+
+// Tagged messages carry a request id so that many requests can be in flight
+// on one child and be answered in any order. On text channels the id is a
+// "<id>\t" prefix, on framed channels it is a uint64_t in native byte order
+// right after the header (PB_FRAME_FLAG_TAGGED is set).
+
+// Child side: answer a request by sending back the id it came with.
+// Text mailboxes also hold the "<id>\t" prefix while receiving.
+PB_status_t PB_send_tagged(PB_process_t *, uint64_t id, const void *data, size_t length);
+PB_status_t PB_try_send_tagged(PB_process_t *, uint64_t id, const void *data, size_t length);
+PB_status_t PB_receive_tagged(PB_process_t *, uint64_t *id, void *mailbox, size_t size, size_t *length);
+
+// Parent side: every request gets a fresh id and stays in the process's
+// in-flight table until its response arrives or it is cancelled. status is
+// PB_STATUS_OK with the response, or PB_STATUS_TERMINATED when the child
+// closed its stdout or the request was cancelled. response is only valid
+// during the call; the callback may issue new requests but not receive.
+typedef void (*PB_response_callback_t)(PB_process_t *, PB_status_t status, const char *response, size_t length, void *user_data);
+
+// Sends are blocking unless the process is non-blocking: with a deep
+// pipeline, prefer PB_set_nonblocking so that requests queue instead.
+PB_status_t PB_request(PB_process_t *, const char *message, PB_response_callback_t, void *user_data, uint64_t *id);
+PB_status_t PB_request_bytes(PB_process_t *, const void *data, size_t length, PB_response_callback_t, void *user_data, uint64_t *id);
+
+// Waits up to timeout_ms (negative: forever) for responses and dispatches
+// every one that is complete.
+PB_status_t PB_poll_responses(PB_process_t *, int timeout_ms);
+// For responses read elsewhere, e.g. PB_EVENT_MESSAGE of an event loop.
+PB_status_t PB_handle_response(PB_process_t *, const char *data, size_t length);
+size_t PB_requests_in_flight(const PB_process_t *);
+// Calls back every in-flight request with PB_STATUS_TERMINATED.
+void PB_cancel_requests(PB_process_t *);
+
 // -----------------------------------------------------------------------------
 // Errors management
 // -----------------------------------------------------------------------------
 
-void PB_clear_error(PB_process_t *);
\ No newline at end of file
+void PB_clear_error(PB_process_t *);
+
+// -----------------------------------------------------------------------------
+// Event loop (Linux only)
+// -----------------------------------------------------------------------------
+
+// One epoll instance watching stdout, stderr and stdin writability of many
+// children. Added children are switched to non-blocking mode; use
+// PB_try_send to write to them, the loop drains what gets queued.
+
+typedef struct PB_loop_t PB_loop_t;
+
+// The io_uring backend reads the pipes of all children into registered
+// buffers, one io_uring_enter per iteration. It needs the PB_WITH_IO_URING
+// build option and a kernel that allows it, else the loop uses epoll.
+// Its reads stay pending on the pipes, so until PB_loop_remove the children
+// can only be received from through the callback: PB_receive and its try and
+// timeout variants fail with PB_STATUS_USAGE_ERROR.
+typedef enum
+{
+    PB_LOOP_BACKEND_EPOLL = 0,
+    PB_LOOP_BACKEND_IO_URING = 1,
+} PB_loop_backend_t;
+
+typedef enum
+{
+    PB_EVENT_MESSAGE = 0,     // complete line or frame on stdout
+    PB_EVENT_ERR_MESSAGE = 1, // complete line on stderr
+    PB_EVENT_CLOSED = 2,      // stdout reached EOF, data is NULL
+} PB_event_t;
+
+// data points into the receive buffer and is only valid during the call.
+// The callback may send, or remove the process from the loop.
+typedef void (*PB_loop_callback_t)(PB_loop_t *, PB_process_t *, PB_event_t, const char *data, size_t length, void *user_data);
+
+// Uses io_uring when the PB_LOOP_BACKEND environment variable is "io_uring".
+PB_loop_t *PB_loop_create(void);
+PB_loop_t *PB_loop_create_backend(PB_loop_backend_t);
+// The backend actually in use.
+PB_loop_backend_t PB_loop_backend(const PB_loop_t *);
+void PB_loop_destroy(PB_loop_t *);
+PB_status_t PB_loop_add(PB_loop_t *, PB_process_t *, PB_loop_callback_t, void *user_data);
+PB_status_t PB_loop_remove(PB_loop_t *, PB_process_t *);
+
+// Waits up to timeout_ms (negative: forever) and dispatches what is ready.
+PB_status_t PB_loop_run_once(PB_loop_t *, int timeout_ms);
+// Dispatches until PB_loop_stop is called or no process is left.
+PB_status_t PB_loop_run(PB_loop_t *);
+void PB_loop_stop(PB_loop_t *);
+
+// -----------------------------------------------------------------------------
+// Asynchronous operations (Linux only)
+// -----------------------------------------------------------------------------
+
+// Sends and receives that return at once, for code driven by its own event
+// loop. Add PB_async_fd to it (poll, epoll...): once readable, call
+// PB_async_dispatch, which calls back every operation that completed. The
+// first call switches the child to non-blocking mode. Do not mix with
+// PB_loop_add or blocking receives on the same child.
+
+// Receives get a view of one message (data, length), only valid during the
+// call. Sends are done once the message was written (data is NULL, length
+// is the message's). On failure status is PB_STATUS_TERMINATED: the child
+// closed its stdout or stdin, or the operations were cancelled. The
+// callback may start new operations, and cancel, despawn or destroy: the
+// dispatch then stops and the other operations get PB_STATUS_TERMINATED.
+typedef void (*PB_async_callback_t)(PB_process_t *, PB_status_t status, const char *data, size_t length, void *user_data);
+
+// length bytes form one line (text) or one frame (length-prefixed).
+PB_status_t PB_send_async(PB_process_t *, const void *data, size_t length, PB_async_callback_t, void *user_data);
+// Completes in order, one message per call.
+PB_status_t PB_receive_async(PB_process_t *, PB_async_callback_t, void *user_data);
+// -1 if the child is not spawned. Stays the same until PB_async_cancel.
+int PB_async_fd(PB_process_t *);
+PB_status_t PB_async_dispatch(PB_process_t *);
+size_t PB_async_pending(const PB_process_t *);
+// Calls back every pending operation with PB_STATUS_TERMINATED and closes
+// the fd. PB_despawn and PB_destroy do it too.
+void PB_async_cancel(PB_process_t *);
+
+// -----------------------------------------------------------------------------
+// Process pool (Linux only)
+// -----------------------------------------------------------------------------
+
+// n_workers copies of command answering one line per request line. Each
+// request goes to the idle worker that served the fewest requests, or waits
+// in a FIFO until one is idle, so a slow request never delays the others.
+
+typedef struct PB_pool_t PB_pool_t;
+
+// status is PB_STATUS_OK with the response, or PB_STATUS_TERMINATED when the
+// worker died or the pool was destroyed first.
+typedef void (*PB_pool_callback_t)(PB_pool_t *, PB_status_t status, const char *response, size_t length, void *user_data);
+
+PB_pool_t *PB_pool_create(const char *command, size_t n_workers);
+void PB_pool_destroy(PB_pool_t *);
+// PB_STATUS_TERMINATED, without calling back, once every worker died.
+PB_status_t PB_pool_submit(PB_pool_t *, const char *request, PB_pool_callback_t, void *user_data);
+
+// Callbacks run from these calls only.
+PB_status_t PB_pool_run_once(PB_pool_t *, int timeout_ms);
+PB_status_t PB_pool_wait(PB_pool_t *); // until no request is outstanding
+size_t PB_pool_outstanding(const PB_pool_t *);
+
+// -----------------------------------------------------------------------------
+// Warm standby children
+// -----------------------------------------------------------------------------
+
+// Keeps standby spawned copies of each command ready to be handed out, so
+// that slow-starting children start before they are needed. With a
+// ready_line, a child is ready once it printed that exact line (consumed by
+// the library); without one, as soon as it is spawned. A child that did not
+// print it within handshake_timeout_ms (negative: no limit) is discarded.
+
+typedef struct PB_warm_t PB_warm_t;
+
+PB_warm_t *PB_warm_create(size_t standby, const char *ready_line, int handshake_timeout_ms);
+// Despawns every standby child, handed out ones are not affected.
+void PB_warm_destroy(PB_warm_t *);
+// Spawns the standby children of command ahead of the first acquire.
+PB_status_t PB_warm_prepare(PB_warm_t *, const char *command);
+// Hands out a ready child, or waits for the oldest standby one, or spawns
+// one cold when it failed or timed out, then spawns its replacement without
+// waiting for its handshake. Blocks up to twice handshake_timeout_ms: once
+// on the oldest standby child, once more on the cold one.
+// The caller owns the child (PB_wait and PB_destroy it); NULL on failure.
+PB_process_t *PB_acquire_warm(PB_warm_t *, const char *command);
+// How many standby children of command are ready right now.
+size_t PB_warm_ready(PB_warm_t *, const char *command);
+
+// -----------------------------------------------------------------------------
+// Zygote (Unix only)
+// -----------------------------------------------------------------------------
+
+// A zygote is one copy of a process_bridge program that initializes once,
+// then fork()s a child per spawn: the children share what it loaded
+// copy-on-write and skip its start-up. Their stdio pipes are created here and
+// passed to the zygote over a Unix socket.
+// The program calls PB_zygote_serve once initialized, before PB_create. It
+// returns in every forked child, and right away when the program was not
+// started as a zygote, so the same program also works with PB_spawn.
+
+PB_zygote_t *PB_zygote_create(const char *command);
+// Ends the zygote. Wait for, despawn or destroy its children first: the
+// zygote reaps them and reports their exit to PB_wait.
+void PB_zygote_destroy(PB_zygote_t *);
+// PB_spawn for a child forked by the zygote: pipes only, default sizes.
+PB_status_t PB_spawn_from_zygote(PB_zygote_t *, PB_process_t *child);
+PB_status_t PB_zygote_serve(void);
+
+// -----------------------------------------------------------------------------
+// Supervisor
+// -----------------------------------------------------------------------------
+
+// Keeps one child of command alive. A child whose stdout reaches end of file
+// or that exits is replaced: at once after a run of at least stable_ms, then
+// after backoff_initial_ms, doubling up to backoff_max_ms. With a ready_line
+// a new child only counts as up once it printed it (the same as for
+// PB_warm_create). Requests (PB_request) that the dead child did not answer
+// go to handback, which may keep them to request them again once a child is
+// up; without handback they are cancelled.
+
+typedef struct PB_supervisor_t PB_supervisor_t;
+
+// request is only valid during the call.
+typedef void (*PB_handback_callback_t)(PB_supervisor_t *, const char *request, size_t length, PB_response_callback_t callback, void *request_user_data, void *user_data);
+
+// Zero fields keep the defaults: 10 ms, 5 s, 10 s, text framing.
+typedef struct
+{
+    const char *ready_line;
+    int backoff_initial_ms;
+    int backoff_max_ms;
+    int stable_ms;
+    PB_framing_t framing;
+    PB_handback_callback_t handback;
+    void *user_data;
+} PB_supervisor_options_t;
+
+PB_supervisor_t *PB_supervisor_create(const char *command, const PB_supervisor_options_t *);
+// Kills the child, cancelling its requests.
+void PB_supervisor_destroy(PB_supervisor_t *);
+// Waits up to timeout_ms (negative: forever) for the child to come up, or
+// dispatches the responses of a child that is up. Detects crashes and
+// respawns. PB_STATUS_OK when a child is up on return, else PB_STATUS_TERMINATED.
+PB_status_t PB_supervisor_poll(PB_supervisor_t *, int timeout_ms);
+// The child that is up, NULL meanwhile. It changes after a crash: fetch it
+// again rather than keeping it.
+PB_process_t *PB_supervisor_process(const PB_supervisor_t *);
+size_t PB_supervisor_restarts(const PB_supervisor_t *);
+
+// -----------------------------------------------------------------------------
+// Threaded mode (Unix only)
+// -----------------------------------------------------------------------------
+
+// An I/O thread takes over a spawned child (pipe transport) so that any
+// number of threads can send it requests: submissions go through a lock-free
+// MPSC queue and only the I/O thread touches the child. Its stdout must only
+// carry responses to tagged requests (see PB_request). The child must not be
+// used directly until PB_threaded_destroy gives it back, non-blocking.
+
+typedef struct PB_threaded_t PB_threaded_t;
+
+PB_threaded_t *PB_threaded_create(PB_process_t *child);
+// Stops the thread. Requests still queued or in flight get PB_STATUS_TERMINATED.
+void PB_threaded_destroy(PB_threaded_t *);
+// From any thread. The callback runs on the I/O thread, with a NULL process
+// when the request could not be sent; it must not block.
+PB_status_t PB_threaded_request(PB_threaded_t *, const void *data, size_t length, PB_response_callback_t, void *user_data);
+// From any thread: waits for the response. If it is larger than size,
+// *response_length tells its size and PB_STATUS_GENERIC_ERROR is returned.
+PB_status_t PB_threaded_call(PB_threaded_t *, const void *data, size_t length, void *response, size_t size, size_t *response_length);
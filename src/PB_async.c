@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_buffer.h"
+#include "PB_internal.h"
+#include "PB_shm.h"
+#include "process_bridge.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define PB_ASYNC_VIEWS 64
+#define PB_ASYNC_READS 16 // per dispatch, then other fds of the caller get their turn
+
+typedef enum
+{
+    WATCH_STDIN = 0,
+    WATCH_STDOUT = 1,
+    WATCH_READY = 2,
+    WATCH_WAKE = 3, // eventfd of the shared memory rings
+} watch_t;
+
+typedef struct operation_t operation_t;
+struct operation_t
+{
+    PB_async_callback_t callback;
+    void *user_data;
+    size_t length;
+    uint64_t mark; // sends: done once the send queue consumed this many bytes
+    operation_t *next;
+};
+
+typedef struct
+{
+    operation_t *head;
+    operation_t *tail;
+    size_t count;
+} queue_t;
+
+struct PB_async_t
+{
+    int epoll_fd; // what PB_async_fd hands out
+    int ready_fd; // eventfd: completions that need no I/O
+    queue_t sends;
+    queue_t receives;
+    uint32_t stdin_events; // interest currently set
+    uint32_t stdout_events;
+    bool stdin_closed; // reader gone, removed from epoll
+    bool stdout_closed;
+    bool eof;
+    bool *gone; // of the running dispatch, set once a callback cancels
+};
+
+static PB_async_t *get_async(PB_process_t *process);
+static bool watch(PB_async_t *async, int fd, watch_t tag, uint32_t events);
+static void update_interest(PB_process_t *process);
+static void signal_ready(PB_async_t *async);
+static void push(queue_t *queue, operation_t *operation);
+static operation_t *pop(queue_t *queue);
+static bool fail_all(PB_process_t *process, queue_t *queue, PB_status_t status, const bool *gone);
+static bool send_done(const PB_process_t *process, const operation_t *operation);
+static PB_status_t dispatch(PB_process_t *process, PB_async_t *async, const bool *gone);
+
+//------------------------------------------------------------------------------
+
+PB_status_t PB_send_async(PB_process_t *process, const void *data, size_t length, PB_async_callback_t callback, void *user_data)
+{
+    if (NULL == process || NULL == data || NULL == callback)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    PB_async_t *async = get_async(process);
+    if (NULL == async)
+    {
+        return process->status;
+    }
+    operation_t *operation = (operation_t *)malloc(sizeof(operation_t));
+    if (NULL == operation)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    PB_status_t status = PB_try_send_message(process, data, length);
+    if (PB_STATUS_OK != status && PB_STATUS_WOULD_BLOCK != status)
+    {
+        free(operation);
+        return status;
+    }
+
+    // Whatever is queued now, this message included, has to leave first.
+    PB_buffer_t *queue = process->send_buffer;
+    operation->callback = callback;
+    operation->user_data = user_data;
+    operation->length = length;
+    operation->mark = NULL == queue ? 0 : queue->consumed + PB_buffer_length(queue);
+    push(&async->sends, operation);
+    if (send_done(process, operation))
+    {
+        signal_ready(async);
+    }
+    update_interest(process);
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_receive_async(PB_process_t *process, PB_async_callback_t callback, void *user_data)
+{
+    if (NULL == process || NULL == callback)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    PB_async_t *async = get_async(process);
+    if (NULL == async)
+    {
+        return process->status;
+    }
+    operation_t *operation = (operation_t *)malloc(sizeof(operation_t));
+    if (NULL == operation)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    operation->callback = callback;
+    operation->user_data = user_data;
+    operation->length = 0;
+    operation->mark = 0;
+    push(&async->receives, operation);
+
+    // Messages already buffered, or an EOF, will not make stdout readable.
+    PB_buffer_t *buffer = process->receive_buffer;
+    if (async->eof || async->stdout_closed || (NULL != buffer && PB_buffer_length(buffer) > 0))
+    {
+        signal_ready(async);
+    }
+    update_interest(process);
+    return PB_STATUS_OK;
+}
+
+int PB_async_fd(PB_process_t *process)
+{
+    PB_async_t *async = NULL == process ? NULL : get_async(process);
+    return NULL == async ? -1 : async->epoll_fd;
+}
+
+PB_status_t PB_async_dispatch(PB_process_t *process)
+{
+    if (NULL == process || NULL == process->async)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+    PB_async_t *async = process->async;
+
+    // A callback may despawn or destroy the process, which cancels and frees
+    // async: from then on neither may be touched, only gone is left.
+    bool gone = false;
+    bool *outer = async->gone;
+    async->gone = &gone;
+    PB_status_t status = dispatch(process, async, &gone);
+    if (gone && NULL != outer)
+    {
+        *outer = true; // a dispatch from a callback, the outer one stops too
+    }
+    else if (!gone)
+    {
+        async->gone = outer;
+    }
+    return status;
+}
+
+size_t PB_async_pending(const PB_process_t *process)
+{
+    if (NULL == process || NULL == process->async)
+    {
+        return 0;
+    }
+    return process->async->sends.count + process->async->receives.count;
+}
+
+void PB_async_cancel(PB_process_t *process)
+{
+    if (NULL == process || NULL == process->async)
+    {
+        return;
+    }
+
+    // Detached first: callbacks may start new operations.
+    PB_async_t *async = process->async;
+    process->async = NULL;
+    if (NULL != async->gone)
+    {
+        *async->gone = true;
+    }
+    fail_all(process, &async->sends, PB_STATUS_TERMINATED, NULL);
+    fail_all(process, &async->receives, PB_STATUS_TERMINATED, NULL);
+    if (NULL != process->shm)
+    {
+        PB_shm_watch(process->shm, false);
+    }
+    close(async->ready_fd);
+    close(async->epoll_fd);
+    free(async);
+}
+
+//------------------------------------------------------------------------------
+
+// One round of PB_async_dispatch, returning as soon as *gone is set.
+static PB_status_t dispatch(PB_process_t *process, PB_async_t *async, const bool *gone)
+{
+    eventfd_t value;
+    eventfd_read(async->ready_fd, &value);
+    if (NULL != process->shm)
+    {
+        PB_shm_clear_wake(process->shm);
+    }
+
+    // epoll reports a closed peer even without interest: stop watching it.
+    struct epoll_event events[4];
+    int ready = epoll_wait(async->epoll_fd, events, 4, 0);
+    for (int i = 0; i < ready; i++)
+    {
+        bool hangup = 0 != (events[i].events & (EPOLLERR | EPOLLHUP));
+        if (hangup && WATCH_STDIN == events[i].data.u32 && !async->stdin_closed)
+        {
+            epoll_ctl(async->epoll_fd, EPOLL_CTL_DEL, process->stdin_fd, NULL);
+            async->stdin_closed = true;
+        }
+        else if (hangup && WATCH_STDOUT == events[i].data.u32 && !async->stdout_closed)
+        {
+            epoll_ctl(async->epoll_fd, EPOLL_CTL_DEL, process->stdout_fd, NULL);
+            async->stdout_closed = true; // reads below find what is left, then EOF
+        }
+    }
+
+    // Sends: write what is queued, then complete those that left.
+    PB_buffer_t *queue = process->send_buffer;
+    if (NULL != queue && PB_buffer_length(queue) > 0 && PB_STATUS_GENERIC_ERROR == PB_flush(process))
+    {
+        async->stdin_closed = true;
+    }
+    while (NULL != async->sends.head && send_done(process, async->sends.head))
+    {
+        operation_t *operation = pop(&async->sends);
+        operation->callback(process, PB_STATUS_OK, NULL, operation->length, operation->user_data);
+        free(operation);
+        if (*gone)
+        {
+            return PB_STATUS_OK;
+        }
+    }
+    if (async->stdin_closed && fail_all(process, &async->sends, PB_STATUS_TERMINATED, gone))
+    {
+        return PB_STATUS_OK;
+    }
+
+    // Receives: one message each, views stay valid during the callback.
+    PB_message_view_t views[PB_ASYNC_VIEWS];
+    int reads = 0;
+    while (NULL != async->receives.head && !async->eof && reads < PB_ASYNC_READS)
+    {
+        size_t wanted = async->receives.count < PB_ASYNC_VIEWS ? async->receives.count : PB_ASYNC_VIEWS;
+        size_t count = 0;
+        bool eof = false;
+        PB_status_t status = PB_receive_views(process, false, views, wanted, &count, 0, &eof);
+        if (PB_STATUS_TIMEOUT == status)
+        {
+            break;
+        }
+        async->eof = eof || PB_STATUS_OK != status;
+        for (size_t i = 0; i < count; i++)
+        {
+            operation_t *operation = pop(&async->receives);
+            operation->callback(process, PB_STATUS_OK, views[i].data, views[i].length, operation->user_data);
+            free(operation);
+            if (*gone)
+            {
+                return PB_STATUS_OK; // the views went with the receive buffer
+            }
+        }
+        reads++;
+    }
+    if (async->eof && fail_all(process, &async->receives, PB_STATUS_TERMINATED, gone))
+    {
+        return PB_STATUS_OK;
+    }
+    else if (NULL != async->receives.head && reads == PB_ASYNC_READS)
+    {
+        signal_ready(async); // more may be buffered already
+    }
+
+    update_interest(process);
+    return PB_STATUS_OK;
+}
+
+// Created on first use: the child goes non-blocking and its fds join an
+// epoll set of their own, so that one fd tells when to dispatch.
+static PB_async_t *get_async(PB_process_t *process)
+{
+    if (NULL != process->async)
+    {
+        return process->async;
+    }
+
+    if (PB_TYPE_CHILD != process->type || -1 == process->stdout_fd)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Async operations need a spawned child process.");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return NULL;
+    }
+    if (PB_STATUS_OK != PB_set_nonblocking(process, true))
+    {
+        return NULL;
+    }
+
+    PB_async_t *async = (PB_async_t *)calloc(1, sizeof(PB_async_t));
+    if (NULL == async)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return NULL;
+    }
+    async->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    async->ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    // stdin and stdout start with no interest, update_interest arms them.
+    bool watched = -1 != async->epoll_fd && -1 != async->ready_fd;
+    watched = watched && watch(async, process->stdin_fd, WATCH_STDIN, 0);
+    watched = watched && watch(async, process->stdout_fd, WATCH_STDOUT, 0);
+    watched = watched && watch(async, async->ready_fd, WATCH_READY, EPOLLIN);
+    watched = watched && (NULL == process->shm || watch(async, PB_shm_wake_fd(process->shm), WATCH_WAKE, EPOLLIN));
+    if (!watched)
+    {
+        if (-1 != async->epoll_fd)
+        {
+            close(async->epoll_fd);
+        }
+        if (-1 != async->ready_fd)
+        {
+            close(async->ready_fd);
+        }
+        free(async);
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Error while setting up the async fd.");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return NULL;
+    }
+
+    // With rings, the peer signals the wake fd on every read and write.
+    if (NULL != process->shm)
+    {
+        PB_shm_watch(process->shm, true);
+    }
+    process->async = async;
+    return async;
+}
+
+static bool watch(PB_async_t *async, int fd, watch_t tag, uint32_t events)
+{
+    struct epoll_event event = {.events = events, .data.u32 = tag};
+    return 0 == epoll_ctl(async->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// stdout is watched while receives wait, stdin while sends are queued.
+// Rings report data and free room through the wake fd instead.
+static void update_interest(PB_process_t *process)
+{
+    PB_async_t *async = process->async;
+    PB_buffer_t *queue = process->send_buffer;
+    bool queued = NULL != queue && PB_buffer_length(queue) > 0;
+
+    uint32_t stdin_events = queued && NULL == process->shm ? EPOLLOUT : 0;
+    if (!async->stdin_closed && stdin_events != async->stdin_events)
+    {
+        struct epoll_event event = {.events = stdin_events, .data.u32 = WATCH_STDIN};
+        if (0 == epoll_ctl(async->epoll_fd, EPOLL_CTL_MOD, process->stdin_fd, &event))
+        {
+            async->stdin_events = stdin_events;
+        }
+    }
+
+    uint32_t stdout_events = NULL != async->receives.head && !async->eof ? EPOLLIN : 0;
+    if (!async->stdout_closed && stdout_events != async->stdout_events)
+    {
+        struct epoll_event event = {.events = stdout_events, .data.u32 = WATCH_STDOUT};
+        if (0 == epoll_ctl(async->epoll_fd, EPOLL_CTL_MOD, process->stdout_fd, &event))
+        {
+            async->stdout_events = stdout_events;
+        }
+    }
+}
+
+static void signal_ready(PB_async_t *async)
+{
+    eventfd_write(async->ready_fd, 1);
+}
+
+static void push(queue_t *queue, operation_t *operation)
+{
+    operation->next = NULL;
+    if (NULL == queue->tail)
+    {
+        queue->head = operation;
+    }
+    else
+    {
+        queue->tail->next = operation;
+    }
+    queue->tail = operation;
+    queue->count++;
+}
+
+static operation_t *pop(queue_t *queue)
+{
+    operation_t *operation = queue->head;
+    queue->head = operation->next;
+    if (NULL == queue->head)
+    {
+        queue->tail = NULL;
+    }
+    queue->count--;
+    return operation;
+}
+
+// true when a callback cancelled the dispatch gone belongs to (NULL: none).
+static bool fail_all(PB_process_t *process, queue_t *queue, PB_status_t status, const bool *gone)
+{
+    while (NULL != queue->head)
+    {
+        operation_t *operation = pop(queue);
+        operation->callback(process, status, NULL, 0, operation->user_data);
+        free(operation);
+        if (NULL != gone && *gone)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool send_done(const PB_process_t *process, const operation_t *operation)
+{
+    const PB_buffer_t *queue = process->send_buffer;
+    return NULL == queue || queue->consumed >= operation->mark;
+}
+
+#else // no epoll
+
+PB_status_t PB_send_async(PB_process_t *process, const void *data, size_t length, PB_async_callback_t callback, void *user_data)
+{
+    (void)process;
+    (void)data;
+    (void)length;
+    (void)callback;
+    (void)user_data;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_receive_async(PB_process_t *process, PB_async_callback_t callback, void *user_data)
+{
+    (void)process;
+    (void)callback;
+    (void)user_data;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+int PB_async_fd(PB_process_t *process)
+{
+    (void)process;
+    return -1;
+}
+
+PB_status_t PB_async_dispatch(PB_process_t *process)
+{
+    (void)process;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+size_t PB_async_pending(const PB_process_t *process)
+{
+    (void)process;
+    return 0;
+}
+
+void PB_async_cancel(PB_process_t *process)
+{
+    (void)process;
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_buffer.h"
+#include "PB_generic_functions.h"
+
+PB_buffer_t *PB_buffer_create(size_t capacity)
+{
+    PB_buffer_t *buffer = (PB_buffer_t *)malloc(sizeof(PB_buffer_t));
+    if (NULL == buffer)
+    {
+        return NULL;
+    }
+    buffer->data = (char *)malloc(capacity);
+    if (NULL == buffer->data)
+    {
+        free(buffer);
+        return NULL;
+    }
+    buffer->capacity = capacity;
+    buffer->start = 0;
+    buffer->end = 0;
+    buffer->consumed = 0;
+    return buffer;
+}
+
+void PB_buffer_destroy(PB_buffer_t *buffer)
+{
+    if (NULL != buffer)
+    {
+        free(buffer->data);
+        free(buffer);
+    }
+}
+
+const char *PB_buffer_begin(const PB_buffer_t *buffer)
+{
+    return buffer->data + buffer->start;
+}
+
+size_t PB_buffer_length(const PB_buffer_t *buffer)
+{
+    return buffer->end - buffer->start;
+}
+
+// Returns a pointer to the free tail of the buffer, after moving the pending
+// bytes to the front and growing the storage to at least min_capacity.
+char *PB_buffer_prepare(PB_buffer_t *buffer, size_t min_capacity, size_t *space)
+{
+    size_t length = PB_buffer_length(buffer);
+    if (buffer->start > 0)
+    {
+        memmove(buffer->data, buffer->data + buffer->start, length);
+        buffer->start = 0;
+        buffer->end = length;
+    }
+
+    if (buffer->capacity < min_capacity)
+    {
+        size_t capacity = 2 * buffer->capacity > min_capacity ? 2 * buffer->capacity : min_capacity;
+        char *data = (char *)realloc(buffer->data, capacity);
+        if (NULL == data)
+        {
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    *space = buffer->capacity - buffer->end;
+    return buffer->data + buffer->end;
+}
+
+// Copies n bytes at the end of the buffer, returns non-zero on allocation failure.
+int PB_buffer_append(PB_buffer_t *buffer, const void *data, size_t n)
+{
+    size_t space = 0;
+    char *destination = PB_buffer_prepare(buffer, PB_buffer_length(buffer) + n, &space);
+    if (NULL == destination)
+    {
+        return 1;
+    }
+    memcpy(destination, data, n);
+    PB_buffer_commit(buffer, n);
+    return 0;
+}
+
+void PB_buffer_commit(PB_buffer_t *buffer, size_t n)
+{
+    buffer->end += n;
+}
+
+void PB_buffer_consume(PB_buffer_t *buffer, size_t n)
+{
+    buffer->consumed += n;
+    buffer->start += n;
+    if (buffer->start == buffer->end)
+    {
+        buffer->start = 0;
+        buffer->end = 0;
+    }
+}
+
+// Copies the next line into mailbox (without its newline) and consumes it.
+// A line that does not fit is split at size - 1 bytes, the rest stays buffered.
+// With flush set, a trailing line without newline is returned as well (EOF).
+// Returns false when more data is needed.
+bool PB_buffer_take_line(PB_buffer_t *buffer, char *mailbox, size_t size, bool flush)
+{
+    const char *begin = PB_buffer_begin(buffer);
+    size_t length = PB_buffer_length(buffer);
+    size_t limit = size - 1;
+
+    size_t scan = length < limit + 1 ? length : limit + 1;
+    const char *newline = (const char *)memchr(begin, '\n', scan);
+
+    size_t copy;
+    size_t consumed;
+    if (NULL != newline)
+    {
+        copy = newline - begin;
+        consumed = copy + 1;
+    }
+    else if (length >= limit || (flush && length > 0))
+    {
+        copy = length < limit ? length : limit;
+        consumed = copy;
+    }
+    else
+    {
+        return false;
+    }
+
+    memcpy(mailbox, begin, copy);
+    mailbox[copy] = '\0';
+    PB_buffer_consume(buffer, consumed);
+    PB_strip_newlines(mailbox);
+    return true;
+}
+
+// Turns every complete line into a view pointing into the buffer and consumes
+// it. Newlines are overwritten with NULs, so views are also C strings; with
+// flush set, the caller guarantees one spare byte after a trailing line.
+size_t PB_buffer_take_lines(PB_buffer_t *buffer, PB_message_view_t *views, size_t max_views, bool flush)
+{
+    size_t count = 0;
+    while (count < max_views && PB_buffer_length(buffer) > 0)
+    {
+        char *begin = buffer->data + buffer->start;
+        size_t length = PB_buffer_length(buffer);
+
+        // glibc's memchr is vectorized, which keeps this at memory bandwidth.
+        char *newline = (char *)memchr(begin, '\n', length);
+        size_t consumed;
+        if (NULL != newline)
+        {
+            length = newline - begin;
+            consumed = length + 1;
+        }
+        else if (flush)
+        {
+            consumed = length;
+        }
+        else
+        {
+            break;
+        }
+
+        begin[length] = '\0';
+        if (length > 0 && '\r' == begin[length - 1])
+        {
+            begin[--length] = '\0';
+        }
+        views[count].data = begin;
+        views[count].length = length;
+        count++;
+
+        PB_buffer_consume(buffer, consumed);
+    }
+    return count;
+}
+
+// Turns every complete frame into a view of its payload and consumes it.
+size_t PB_buffer_take_frames(PB_buffer_t *buffer, PB_message_view_t *views, size_t max_views)
+{
+    size_t count = 0;
+    while (count < max_views && PB_buffer_length(buffer) >= sizeof(PB_frame_header_t))
+    {
+        PB_frame_header_t header;
+        memcpy(&header, PB_buffer_begin(buffer), sizeof(header));
+        size_t total = sizeof(header) + header.length;
+        if (PB_buffer_length(buffer) < total)
+        {
+            break;
+        }
+
+        views[count].data = PB_buffer_begin(buffer) + sizeof(header);
+        views[count].length = header.length;
+        count++;
+
+        PB_buffer_consume(buffer, total);
+    }
+    return count;
+}
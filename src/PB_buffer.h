@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "process_bridge.h"
+
+#define PB_BUFFER_SIZE_DEFAULT 65536
+
+struct PB_buffer_t
+{
+    char *data;
+    size_t capacity;
+    size_t start; // first byte not consumed yet
+    size_t end;   // one past the last valid byte
+    uint64_t consumed; // bytes consumed since creation
+};
+
+PB_buffer_t *PB_buffer_create(size_t capacity);
+void PB_buffer_destroy(PB_buffer_t *buffer);
+
+const char *PB_buffer_begin(const PB_buffer_t *buffer);
+size_t PB_buffer_length(const PB_buffer_t *buffer);
+char *PB_buffer_prepare(PB_buffer_t *buffer, size_t min_capacity, size_t *space);
+int PB_buffer_append(PB_buffer_t *buffer, const void *data, size_t n);
+void PB_buffer_commit(PB_buffer_t *buffer, size_t n);
+void PB_buffer_consume(PB_buffer_t *buffer, size_t n);
+
+bool PB_buffer_take_line(PB_buffer_t *buffer, char *mailbox, size_t size, bool flush);
+size_t PB_buffer_take_lines(PB_buffer_t *buffer, PB_message_view_t *views, size_t max_views, bool flush);
+size_t PB_buffer_take_frames(PB_buffer_t *buffer, PB_message_view_t *views, size_t max_views);
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_drain.h"
+#include "PB_generic_functions.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "PB_internal.h"
+
+struct PB_drain_t
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t readable;
+    int fd;
+    int stop_pipe[2]; // written to stop the thread
+
+    // Ring of the last capacity lines, guarded by mutex.
+    char **lines;
+    size_t capacity;
+    size_t first;
+    size_t count;
+    size_t dropped;
+    bool eof;
+
+    // Line being assembled, only touched by the thread.
+    char partial[PB_DRAIN_LINE_MAX];
+    size_t partial_length;
+};
+
+static void *drain_thread(void *argument);
+static void push_line(PB_drain_t *drain, const char *data, size_t length);
+static void free_lines(PB_drain_t *drain);
+
+//------------------------------------------------------------------------------
+
+PB_drain_t *PB_drain_start(int fd, size_t max_lines)
+{
+    PB_drain_t *drain = (PB_drain_t *)calloc(1, sizeof(PB_drain_t));
+    if (NULL == drain)
+    {
+        return NULL;
+    }
+    drain->lines = (char **)calloc(max_lines, sizeof(char *));
+    drain->capacity = max_lines;
+    drain->fd = fd;
+    if (NULL == drain->lines || 0 == max_lines || PB_open_pipe(drain->stop_pipe, 0))
+    {
+        free(drain->lines);
+        free(drain);
+        return NULL;
+    }
+
+    // Deadlines come from PB_monotonic_ms.
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&drain->readable, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&drain->mutex, NULL);
+
+    if (0 != pthread_create(&drain->thread, NULL, drain_thread, drain))
+    {
+        pthread_cond_destroy(&drain->readable);
+        pthread_mutex_destroy(&drain->mutex);
+        PB_close_pipe(drain->stop_pipe);
+        free(drain->lines);
+        free(drain);
+        return NULL;
+    }
+    return drain;
+}
+
+void PB_drain_stop(PB_drain_t *drain)
+{
+    if (NULL == drain)
+    {
+        return;
+    }
+
+    if (1 != write(drain->stop_pipe[1], "", 1))
+    {
+        // cannot happen on a fresh pipe, the thread would not stop
+    }
+    pthread_join(drain->thread, NULL);
+    pthread_cond_destroy(&drain->readable);
+    pthread_mutex_destroy(&drain->mutex);
+    PB_close_pipe(drain->stop_pipe);
+    free_lines(drain);
+    free(drain->lines);
+    free(drain);
+}
+
+PB_status_t PB_drain_take(PB_drain_t *drain, char *mailbox, size_t size, int64_t deadline)
+{
+    pthread_mutex_lock(&drain->mutex);
+    while (0 == drain->count && !drain->eof)
+    {
+        if (PB_NO_DEADLINE == deadline)
+        {
+            pthread_cond_wait(&drain->readable, &drain->mutex);
+            continue;
+        }
+        int64_t remaining = deadline - PB_monotonic_ms();
+        if (remaining <= 0)
+        {
+            pthread_mutex_unlock(&drain->mutex);
+            return PB_STATUS_TIMEOUT;
+        }
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += remaining / 1000;
+        until.tv_nsec += (remaining % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&drain->readable, &drain->mutex, &until);
+    }
+    if (0 == drain->count)
+    {
+        pthread_mutex_unlock(&drain->mutex);
+        return PB_STATUS_TERMINATED;
+    }
+
+    // A line longer than the mailbox is handed out in pieces.
+    char *line = drain->lines[drain->first];
+    size_t length = strlen(line);
+    size_t copy = length < size - 1 ? length : size - 1;
+    memcpy(mailbox, line, copy);
+    mailbox[copy] = '\0';
+    if (copy < length)
+    {
+        memmove(line, line + copy, length - copy + 1);
+    }
+    else
+    {
+        free(line);
+        drain->lines[drain->first] = NULL;
+        drain->first = (drain->first + 1) % drain->capacity;
+        drain->count--;
+    }
+    pthread_mutex_unlock(&drain->mutex);
+    PB_strip_newlines(mailbox);
+    return PB_STATUS_OK;
+}
+
+size_t PB_drain_dropped(PB_drain_t *drain)
+{
+    pthread_mutex_lock(&drain->mutex);
+    size_t dropped = drain->dropped;
+    pthread_mutex_unlock(&drain->mutex);
+    return dropped;
+}
+
+PB_status_t PB_drain_spawned(PB_process_t *child)
+{
+    if (0 == child->stderr_ring_lines)
+    {
+        return PB_STATUS_OK;
+    }
+
+    child->stderr_drain = PB_drain_start(child->stderr_fd, child->stderr_ring_lines);
+    if (NULL == child->stderr_drain)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while starting the stderr drain thread.");
+        child->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+//------------------------------------------------------------------------------
+
+static void *drain_thread(void *argument)
+{
+    PB_drain_t *drain = (PB_drain_t *)argument;
+    char chunk[PB_DRAIN_LINE_MAX];
+
+    for (;;)
+    {
+        struct pollfd pfds[2] = {{drain->fd, POLLIN, 0}, {drain->stop_pipe[0], POLLIN, 0}};
+        if (-1 == poll(pfds, 2, -1))
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            break;
+        }
+        if (pfds[1].revents)
+        {
+            return NULL; // stopped: the ring is being destroyed
+        }
+
+        ssize_t bytes_read = read(drain->fd, chunk, sizeof(chunk));
+        if (-1 == bytes_read && (EINTR == errno || EAGAIN == errno || EWOULDBLOCK == errno))
+        {
+            continue;
+        }
+        if (bytes_read <= 0)
+        {
+            break;
+        }
+
+        // One lock per chunk, not per line.
+        pthread_mutex_lock(&drain->mutex);
+        for (ssize_t i = 0; i < bytes_read; i++)
+        {
+            if ('\n' == chunk[i])
+            {
+                push_line(drain, drain->partial, drain->partial_length);
+                drain->partial_length = 0;
+                continue;
+            }
+            if (PB_DRAIN_LINE_MAX - 1 == drain->partial_length)
+            {
+                push_line(drain, drain->partial, drain->partial_length);
+                drain->partial_length = 0;
+            }
+            drain->partial[drain->partial_length++] = chunk[i];
+        }
+        pthread_cond_broadcast(&drain->readable);
+        pthread_mutex_unlock(&drain->mutex);
+    }
+
+    // End of file: a last line without newline still counts.
+    pthread_mutex_lock(&drain->mutex);
+    if (0 != drain->partial_length)
+    {
+        push_line(drain, drain->partial, drain->partial_length);
+        drain->partial_length = 0;
+    }
+    drain->eof = true;
+    pthread_cond_broadcast(&drain->readable);
+    pthread_mutex_unlock(&drain->mutex);
+    return NULL;
+}
+
+// Called with the mutex held. When full, the oldest line makes room.
+static void push_line(PB_drain_t *drain, const char *data, size_t length)
+{
+    char *line = PB_string_clone(data, length);
+    if (NULL == line)
+    {
+        drain->dropped++;
+        return;
+    }
+    if (drain->count == drain->capacity)
+    {
+        free(drain->lines[drain->first]);
+        drain->lines[drain->first] = NULL;
+        drain->first = (drain->first + 1) % drain->capacity;
+        drain->count--;
+        drain->dropped++;
+    }
+    drain->lines[(drain->first + drain->count) % drain->capacity] = line;
+    drain->count++;
+}
+
+static void free_lines(PB_drain_t *drain)
+{
+    for (size_t i = 0; i < drain->count; i++)
+    {
+        free(drain->lines[(drain->first + i) % drain->capacity]);
+    }
+    drain->count = 0;
+}
+
+#else // _WIN32
+
+PB_drain_t *PB_drain_start(int fd, size_t max_lines)
+{
+    (void)fd;
+    (void)max_lines;
+    return NULL;
+}
+
+void PB_drain_stop(PB_drain_t *drain)
+{
+    (void)drain;
+}
+
+PB_status_t PB_drain_take(PB_drain_t *drain, char *mailbox, size_t size, int64_t deadline)
+{
+    (void)drain;
+    (void)mailbox;
+    (void)size;
+    (void)deadline;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+size_t PB_drain_dropped(PB_drain_t *drain)
+{
+    (void)drain;
+    return 0;
+}
+
+PB_status_t PB_drain_spawned(PB_process_t *child)
+{
+    (void)child;
+    return PB_STATUS_OK;
+}
+
+#endif
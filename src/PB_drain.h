@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "process_bridge.h"
+
+// Background stderr drain: a helper thread reads a child's stderr as soon as
+// anything arrives and keeps the most recent lines in a bounded ring, so the
+// child never blocks on a full stderr pipe.
+
+#define PB_DRAIN_LINE_MAX 4096 // longer lines are split, as a small mailbox would
+
+struct PB_drain_t;
+
+// NULL if the thread cannot be started (or on Windows).
+PB_drain_t *PB_drain_start(int fd, size_t max_lines);
+// Joins the thread before returning: the fd can be closed afterwards.
+void PB_drain_stop(PB_drain_t *drain);
+
+// Oldest line in the ring: PB_STATUS_OK, PB_STATUS_TIMEOUT once the deadline
+// passed, PB_STATUS_TERMINATED when empty at end of file.
+PB_status_t PB_drain_take(PB_drain_t *drain, char *mailbox, size_t size, int64_t deadline);
+size_t PB_drain_dropped(PB_drain_t *drain);
+
+// Starts the drain of a freshly spawned child if it asked for one.
+PB_status_t PB_drain_spawned(PB_process_t *child);
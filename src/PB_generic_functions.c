@@ -5,45 +5,53 @@
 #include "PB_generic_functions.h"
 
 #ifdef _WIN32
+#include <windows.h>
 const char *NEWLINE = "\r\n";
 const size_t NEWLINE_LEN = 2;
 #else // Unix
+#include <errno.h>
+#include <time.h>
 const char *NEWLINE = "\n";
 const size_t NEWLINE_LEN = 1;
 #endif
 
-char *PB_string_clone(const char *s, size_t n)
+int64_t PB_monotonic_ms(void)
 {
-    if (NULL == s)
-    {
-        return NULL;
-    }
-    size_t len = strnlen(s, n);
-    char *clone = (char *)malloc(len + 1);
-    if (NULL == clone)
+#ifdef _WIN32
+    return (int64_t)GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+void PB_sleep_ms(int ms)
+{
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec duration = {ms / 1000, (long)(ms % 1000) * 1000000};
+    while (-1 == nanosleep(&duration, &duration) && EINTR == errno)
     {
-        return NULL;
     }
-    strncpy(clone, s, len);
-    clone[len] = '\0';
-    return clone;
+#endif
 }
 
-char *PB_string_clone_with_newline(const char *s, size_t n)
+char *PB_string_clone(const char *s, size_t n)
 {
     if (NULL == s)
     {
         return NULL;
     }
     size_t len = strnlen(s, n);
-    char *clone = (char *)malloc(len + NEWLINE_LEN + 1);
+    char *clone = (char *)malloc(len + 1);
     if (NULL == clone)
     {
         return NULL;
     }
     strncpy(clone, s, len);
     clone[len] = '\0';
-    strcat(clone, NEWLINE);
     return clone;
 }
 
@@ -1,6 +1,15 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
 extern const char *NEWLINE;
+extern const size_t NEWLINE_LEN;
+
+#define PB_NO_DEADLINE ((int64_t)-1)
+
+int64_t PB_monotonic_ms(void);
+void PB_sleep_ms(int ms);
 
 void PB_strip_newlines(char *str);
 
@@ -11,4 +20,3 @@ int PB_extract_argv(const char *command, char ***argv);
 void PB_free_program_and_argv(char **program, char ***argv);
 
 char *PB_string_clone(const char *s, size_t n);
-char *PB_string_clone_with_newline(const char *s, size_t n);
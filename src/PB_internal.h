@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "process_bridge.h"
+
+// Declarations shared between the library modules, not part of the public API.
+
+PB_status_t PB_receive_views(PB_process_t *process, bool is_err, PB_message_view_t *views, size_t max_views, size_t *count, int timeout_ms, bool *eof);
+PB_status_t PB_try_send_message(PB_process_t *process, const void *data, size_t length);
+// What PB_destroy still owes the peer: written as far as the pipe takes it
+// right now, the rest is dropped. Never blocks nor raises SIGPIPE.
+void PB_flush_without_blocking(PB_process_t *process);
+PB_status_t PB_receive_feed(PB_process_t *process, bool is_err, const char *data, size_t length, bool eof, PB_message_view_t *views, size_t max_views, size_t *count);
+
+// Empties the in-flight table of process, handing every request to take
+// (message is only valid during the call) instead of cancelling it. message
+// is NULL unless process->retain_requests was set before the requests.
+typedef void (*PB_take_request_t)(const char *message, size_t length, PB_response_callback_t callback, void *user_data, void *context);
+void PB_take_requests(PB_process_t *process, PB_take_request_t take, void *context);
+
+#ifndef _WIN32
+// Close-on-exec pipe, resized when size is not 0 (Linux only). -1 ends on error.
+int PB_open_pipe(int fds[2], size_t size);
+void PB_close_pipe(int fds[2]);
+// Copy of environ with entry added, replacing a variable of the same name.
+char **PB_environment_with(const char *entry);
+
+// pidfd of a child (Linux 5.3+), -1 where there is none.
+int PB_open_pidfd(pid_t pid);
+// Reaps a child nobody will wait for from a background thread.
+void PB_reap_in_background(pid_t pid, int pidfd);
+
+// Exit status of a child forked by the zygote, as waitpid() would give it.
+// PB_STATUS_TIMEOUT once deadline (PB_monotonic_ms, or PB_NO_DEADLINE) passed.
+PB_status_t PB_zygote_wait(PB_zygote_t *zygote, pid_t pid, int *status, int64_t deadline);
+// Nobody will wait for pid: its exit report is dropped, now or once it comes.
+void PB_zygote_abandon(PB_zygote_t *zygote, pid_t pid);
+#endif
@@ -1,11 +1,36 @@
+#ifdef __linux__
+#define _GNU_SOURCE // pipe2, F_SETPIPE_SZ
+#endif
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "PB_buffer.h"
+#include "PB_drain.h"
 #include "PB_generic_functions.h"
+#include "PB_internal.h"
+#include "PB_shm.h"
 #include "process_bridge.h"
 
+static void release_buffers(PB_process_t *process);
+
+static const PB_spawn_options_t DEFAULT_SPAWN_OPTIONS = {0, 0, 0, 0};
+
 PB_process_t *PB_create(PB_type_t type)
+{
+    return PB_create_framed(type, PB_FRAMING_TEXT);
+}
+
+PB_process_t *PB_create_framed(PB_type_t type, PB_framing_t framing)
 {
     PB_process_t *process = (PB_process_t *)malloc(sizeof(PB_process_t));
     if (NULL == process)
@@ -13,7 +38,35 @@ PB_process_t *PB_create(PB_type_t type)
         return NULL;
     }
     process->type = type;
+    process->framing = framing;
+    process->transport = PB_TRANSPORT_PIPE;
     process->return_code = PB_DEFAULT_RETURN;
+    process->nonblocking = false;
+    process->loop_reads = false;
+    process->flush_policy = PB_FLUSH_IMMEDIATE;
+    process->receive_buffer = NULL;
+    process->receive_err_buffer = NULL;
+    process->send_buffer = NULL;
+    process->requests = NULL;
+    process->retain_requests = false;
+    process->shm = NULL;
+    process->zygote = NULL;
+    process->stderr_ring_lines = 0;
+    process->stderr_drain = NULL;
+    process->async = NULL;
+#ifdef _WIN32
+    process->process_h = NULL;
+    process->stdin_h = NULL;
+    process->stdout_h = NULL;
+    process->stderr_h = NULL;
+#else
+    process->pid = -1;
+    process->pidfd = -1;
+    process->reaped = false;
+    process->stdin_fd = -1;
+    process->stdout_fd = -1;
+    process->stderr_fd = -1;
+#endif
 
     switch (type)
     {
@@ -22,9 +75,21 @@ PB_process_t *PB_create(PB_type_t type)
         snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Child not spawned");
         break;
     case PB_TYPE_PARENT:
-        setvbuf(stdin, NULL, _IONBF, 0);
         setvbuf(stdout, NULL, _IONBF, 0);
         setvbuf(stderr, NULL, _IONBF, 0);
+#ifdef _WIN32
+        if (PB_FRAMING_LENGTH_PREFIXED == framing)
+        {
+            _setmode(_fileno(stdin), _O_BINARY);
+            _setmode(_fileno(stdout), _O_BINARY);
+        }
+#endif
+        // Rings passed by a parent that spawned us with shared memory.
+        process->shm = PB_shm_attach();
+        if (NULL != process->shm)
+        {
+            process->transport = PB_TRANSPORT_SHARED_MEMORY;
+        }
         PB_clear_string(process->error);
         process->status = PB_STATUS_OK;
         break;
@@ -41,16 +106,62 @@ void PB_destroy(PB_process_t *process)
 {
     if (NULL != process)
     {
+        PB_cancel_requests(process);
+        PB_flush_without_blocking(process); // call PB_flush first to deliver everything
+        release_buffers(process);
+#ifndef _WIN32
+        // Nobody can wait for it anymore.
+        if (-1 != process->pid && !process->reaped && NULL == process->zygote)
+        {
+            PB_reap_in_background(process->pid, process->pidfd);
+        }
+        else
+        {
+            if (-1 != process->pid && !process->reaped)
+            {
+                PB_zygote_abandon(process->zygote, process->pid);
+            }
+            if (-1 != process->pidfd)
+            {
+                close(process->pidfd);
+            }
+        }
+#endif
         free(process);
     }
 }
 
+PB_status_t PB_spawn(PB_process_t *child, const char *command)
+{
+    return PB_spawn_with_options(child, command, NULL);
+}
+
+static void release_buffers(PB_process_t *process)
+{
+    PB_async_cancel(process); // its fds are going away
+    PB_buffer_destroy(process->receive_buffer);
+    process->receive_buffer = NULL;
+    PB_buffer_destroy(process->receive_err_buffer);
+    process->receive_err_buffer = NULL;
+    PB_buffer_destroy(process->send_buffer);
+    process->send_buffer = NULL;
+    PB_shm_destroy(process->shm);
+    process->shm = NULL;
+    PB_drain_stop(process->stderr_drain);
+    process->stderr_drain = NULL;
+}
+
 #ifdef _WIN32
 
 #include <windows.h>
 
-PB_status_t PB_spawn(PB_process_t *child, const char *command)
+PB_status_t PB_spawn_with_options(PB_process_t *child, const char *command, const PB_spawn_options_t *options)
 {
+    if (NULL == options)
+    {
+        options = &DEFAULT_SPAWN_OPTIONS;
+    }
+
     STARTUPINFOA startInfo;
     memset(&startInfo, 0, sizeof(startInfo));
     startInfo.cb = sizeof(startInfo);
@@ -67,7 +178,7 @@ PB_status_t PB_spawn(PB_process_t *child, const char *command)
     security_attributes.nLength = sizeof(security_attributes);
 
     // Create pipe for stdin
-    if (!CreatePipe(&read_h, &write_h, &security_attributes, 0))
+    if (!CreatePipe(&read_h, &write_h, &security_attributes, (DWORD)options->stdin_pipe_size))
     {
         snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while creating child's stdin pipe. Error code: %lu", GetLastError());
         child->status = PB_STATUS_GENERIC_ERROR;
@@ -77,7 +188,7 @@ PB_status_t PB_spawn(PB_process_t *child, const char *command)
     child->stdin_h = write_h;
 
     // Create pipe for stdout
-    if (!CreatePipe(&read_h, &write_h, &security_attributes, 0))
+    if (!CreatePipe(&read_h, &write_h, &security_attributes, (DWORD)options->stdout_pipe_size))
     {
         CloseHandle(startInfo.hStdInput);
         CloseHandle(child->stdin_h);
@@ -89,7 +200,7 @@ PB_status_t PB_spawn(PB_process_t *child, const char *command)
     startInfo.hStdOutput = write_h;
 
     // Create pipe for stderr
-    if (!CreatePipe(&read_h, &write_h, &security_attributes, 0))
+    if (!CreatePipe(&read_h, &write_h, &security_attributes, (DWORD)options->stderr_pipe_size))
     {
         CloseHandle(startInfo.hStdInput);
         CloseHandle(child->stdin_h);
@@ -102,6 +213,11 @@ PB_status_t PB_spawn(PB_process_t *child, const char *command)
     child->stderr_h = read_h;
     startInfo.hStdError = write_h;
 
+    // Keep the parent's ends out of this and later children, like O_CLOEXEC.
+    SetHandleInformation(child->stdin_h, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(child->stdout_h, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(child->stderr_h, HANDLE_FLAG_INHERIT, 0);
+
     // Spawn command
     if (!CreateProcessA(
             NULL,           // lpApplicationName
@@ -151,6 +267,7 @@ PB_status_t PB_despawn(PB_process_t *child)
         return_value = PB_STATUS_GENERIC_ERROR;
     }
     PB_wait(child);
+    release_buffers(child);
 
     if (child->process_h)
     {
@@ -177,9 +294,22 @@ PB_status_t PB_wait(PB_process_t *child)
         CloseHandle(child->stdin_h);
         child->stdin_h = NULL;
     }
+    return PB_wait_timeout(child, -1);
+}
 
-    const DWORD INFINITE_TIME = 0xFFFFFFFF;
-    WaitForSingleObject(child->process_h, INFINITE_TIME);
+PB_status_t PB_wait_timeout(PB_process_t *child, int timeout_ms)
+{
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (WAIT_TIMEOUT == WaitForSingleObject(child->process_h, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms))
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Timed out while waiting for process.");
+        child->status = PB_STATUS_TIMEOUT;
+        return PB_STATUS_TIMEOUT;
+    }
 
     if (!GetExitCodeProcess(child->process_h, &(child->return_code)))
     {
@@ -192,16 +322,113 @@ PB_status_t PB_wait(PB_process_t *child)
     return PB_STATUS_OK;
 }
 
+int PB_exit_fd(const PB_process_t *child)
+{
+    (void)child;
+    return -1; // WaitForSingleObject() on process_h instead
+}
+
+PB_status_t PB_set_nonblocking(PB_process_t *child, bool nonblocking)
+{
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (nonblocking)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Non-blocking mode is not supported on Windows.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_set_transport(PB_process_t *child, PB_transport_t transport)
+{
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_TRANSPORT_PIPE != transport)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Shared memory transport is not supported on Windows.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_set_flush_policy(PB_process_t *process, PB_flush_policy_t policy)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_FLUSH_IMMEDIATE != policy)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Write coalescing is not supported on Windows.");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_set_stderr_ring(PB_process_t *child, size_t max_lines)
+{
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (0 != max_lines)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "The stderr ring is not supported on Windows.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
 #else // Unix
 
 #include <unistd.h>
 #include <spawn.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <signal.h>
 extern char **environ;
 
-PB_status_t PB_spawn(PB_process_t *child, const char *command)
+// posix_spawn_file_actions_addclosefrom_np: glibc 2.34, close_range() inside.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+#define PB_HAVE_CLOSEFROM
+#endif
+
+static int set_fd_nonblocking(int fd, bool nonblocking);
+static void init_stdio_actions(posix_spawn_file_actions_t *actions, const int stdin_pipe[2], const int stdout_pipe[2], const int stderr_pipe[2]);
+static PB_status_t wait_child(PB_process_t *child, int *status, int64_t deadline);
+
+PB_status_t PB_spawn_with_options(PB_process_t *child, const char *command, const PB_spawn_options_t *options)
 {
+    if (NULL == options)
+    {
+        options = &DEFAULT_SPAWN_OPTIONS;
+    }
+
+#ifndef F_SETPIPE_SZ
+    if (0 != options->stdin_pipe_size || 0 != options->stdout_pipe_size || 0 != options->stderr_pipe_size)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Pipe sizes can only be set on Linux.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+#endif
+
     // Command line setup
     char *program = NULL;
     char **argv = NULL;
@@ -228,36 +455,93 @@ PB_status_t PB_spawn(PB_process_t *child, const char *command)
     int stdout_pipe[NUMBER_OF_SIDES];
     int stderr_pipe[NUMBER_OF_SIDES];
 
-    bool stdin_pipe_error = -1 == pipe(stdin_pipe);
-    bool stdout_pipe_error = -1 == pipe(stdout_pipe);
-    bool stderr_pipe_error = -1 == pipe(stderr_pipe);
+    // Every end is close-on-exec: only the dup2() copies reach the child, so
+    // children spawned concurrently never hold each other's pipes open.
+    bool stdin_pipe_error = PB_open_pipe(stdin_pipe, options->stdin_pipe_size);
+    bool stdout_pipe_error = PB_open_pipe(stdout_pipe, options->stdout_pipe_size);
+    bool stderr_pipe_error = PB_open_pipe(stderr_pipe, options->stderr_pipe_size);
 
     if (stdin_pipe_error || stdout_pipe_error || stderr_pipe_error)
     {
         PB_free_program_and_argv(&program, &argv);
-        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while creating pipes.");
+        PB_close_pipe(stdin_pipe);
+        PB_close_pipe(stdout_pipe);
+        PB_close_pipe(stderr_pipe);
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while creating pipes%s.",
+                 EPERM == errno ? ": size above /proc/sys/fs/pipe-max-size" : "");
         child->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    // Actions setup...
+    // Shared memory rings, or plain pipes if they cannot be created
+    PB_shm_destroy(child->shm);
+    child->shm = NULL;
+    if (PB_TRANSPORT_SHARED_MEMORY == child->transport)
+    {
+        child->shm = PB_shm_create(0 == options->ring_size ? PB_SHM_RING_SIZE_DEFAULT : options->ring_size);
+        if (NULL == child->shm)
+        {
+            child->transport = PB_TRANSPORT_PIPE;
+        }
+    }
+    char **envp = environ;
+    if (NULL != child->shm && NULL == (envp = PB_environment_with(PB_shm_environment(child->shm))))
+    {
+        PB_shm_destroy(child->shm);
+        child->shm = NULL;
+        child->transport = PB_TRANSPORT_PIPE;
+        envp = environ;
+    }
+
+    // Actions setup: the pipes become the child's stdio...
     posix_spawn_file_actions_t actions;
-    posix_spawn_file_actions_init(&actions);
-    // ...make duplicates of pipes for child.
-    posix_spawn_file_actions_adddup2(&actions, stdin_pipe[READ_SIDE], STDIN_FILENO);
-    posix_spawn_file_actions_adddup2(&actions, stdout_pipe[WRITE_SIDE], STDOUT_FILENO);
-    posix_spawn_file_actions_adddup2(&actions, stderr_pipe[WRITE_SIDE], STDERR_FILENO);
-    // ...tell child to close its unused pipe sides.
-    posix_spawn_file_actions_addclose(&actions, stdin_pipe[WRITE_SIDE]);
-    posix_spawn_file_actions_addclose(&actions, stdout_pipe[READ_SIDE]);
-    posix_spawn_file_actions_addclose(&actions, stderr_pipe[READ_SIDE]);
+    init_stdio_actions(&actions, stdin_pipe, stdout_pipe, stderr_pipe);
+    // ...hand over the rings, then close every other inherited fd at once.
+    int first_unrelated_fd = STDERR_FILENO + 1;
+    if (NULL != child->shm && 0 != PB_shm_spawn_actions(child->shm, &actions))
+    {
+        // Start over without the half-added ring actions, on plain pipes
+        posix_spawn_file_actions_destroy(&actions);
+        init_stdio_actions(&actions, stdin_pipe, stdout_pipe, stderr_pipe);
+        PB_shm_destroy(child->shm);
+        child->shm = NULL;
+        child->transport = PB_TRANSPORT_PIPE;
+        free(envp);
+        envp = environ;
+    }
+    if (NULL != child->shm)
+    {
+        first_unrelated_fd = PB_SHM_CHILD_FD + 3;
+    }
+#ifdef PB_HAVE_CLOSEFROM
+    posix_spawn_file_actions_addclosefrom_np(&actions, first_unrelated_fd);
+#else
+    (void)first_unrelated_fd; // our own fds are close-on-exec anyway
+#endif
 
-    // Spawn command
-    if (posix_spawn(&child->pid, program, &actions, NULL, argv, environ))
+    // vfork semantics: the child borrows our memory until exec, no page
+    // tables are copied. glibc always does this, other libcs may need the flag.
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+#ifdef POSIX_SPAWN_USEVFORK
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_USEVFORK);
+#endif
+
+    // Spawn command, searching PATH for programs without a slash
+    int spawn_error = posix_spawnp(&child->pid, program, &actions, &attributes, argv, envp);
+    posix_spawnattr_destroy(&attributes);
+    if (envp != environ)
+    {
+        free(envp);
+    }
+    if (spawn_error)
     {
         PB_free_program_and_argv(&program, &argv);
         posix_spawn_file_actions_destroy(&actions);
-        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while extracting arguments from command string.");
+        PB_close_pipe(stdin_pipe);
+        PB_close_pipe(stdout_pipe);
+        PB_close_pipe(stderr_pipe);
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while spawning process: %s", strerror(spawn_error));
         child->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
@@ -275,6 +559,37 @@ PB_status_t PB_spawn(PB_process_t *child, const char *command)
     child->stdin_fd = stdin_pipe[WRITE_SIDE];
     child->stdout_fd = stdout_pipe[READ_SIDE];
     child->stderr_fd = stderr_pipe[READ_SIDE];
+    if (-1 != child->pidfd)
+    {
+        close(child->pidfd); // of a previous spawn
+    }
+    child->pidfd = PB_open_pidfd(child->pid);
+    child->reaped = false;
+    PB_drain_stop(child->stderr_drain); // of a previous spawn
+    child->stderr_drain = NULL;
+    child->zygote = NULL; // our own child, waited with waitpid()
+
+    if (child->nonblocking)
+    {
+        bool stdin_error = set_fd_nonblocking(child->stdin_fd, true);
+        bool stdout_error = set_fd_nonblocking(child->stdout_fd, true);
+        bool stderr_error = set_fd_nonblocking(child->stderr_fd, true);
+        if (stdin_error || stdout_error || stderr_error)
+        {
+            PB_despawn(child); // closes the pipes, kills and reaps the child
+            snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while making pipes non-blocking.");
+            child->status = PB_STATUS_GENERIC_ERROR;
+            return PB_STATUS_GENERIC_ERROR;
+        }
+    }
+
+    if (PB_STATUS_OK != PB_drain_spawned(child))
+    {
+        PB_despawn(child);
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while starting the stderr drain thread.");
+        child->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
 
     PB_clear_string(child->error);
     child->status = PB_STATUS_OK;
@@ -288,10 +603,19 @@ PB_status_t PB_despawn(PB_process_t *child)
         return PB_STATUS_USAGE_ERROR;
     }
 
+    // The drain thread polls stderr: stop it before the fd goes away.
+    PB_drain_stop(child->stderr_drain);
+    child->stderr_drain = NULL;
+
     bool close_stdin_error = -1 == close(child->stdin_fd);
     bool close_stdout_error = -1 == close(child->stdout_fd);
     bool close_stderr_error = -1 == close(child->stderr_fd);
 
+    release_buffers(child);
+    child->stdin_fd = -1;
+    child->stdout_fd = -1;
+    child->stderr_fd = -1;
+
     if (close_stdin_error || close_stdout_error || close_stderr_error)
     {
         snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while closing file descriptors.");
@@ -299,6 +623,18 @@ PB_status_t PB_despawn(PB_process_t *child)
         return PB_STATUS_GENERIC_ERROR;
     }
 
+    // Already gone: its own return code, not the kill's. A child still
+    // running is not an error of ours: the probe leaves no trace.
+    PB_status_t previous_status = child->status;
+    char previous_error[PB_STRING_SIZE_DEFAULT];
+    memcpy(previous_error, child->error, PB_STRING_SIZE_DEFAULT);
+    if (child->reaped || PB_STATUS_OK == PB_wait_timeout(child, 0))
+    {
+        return PB_STATUS_OK;
+    }
+    child->status = previous_status;
+    memcpy(child->error, previous_error, PB_STRING_SIZE_DEFAULT);
+
     if (-1 == kill(child->pid, SIGKILL))
     {
         snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while killing process");
@@ -306,18 +642,55 @@ PB_status_t PB_despawn(PB_process_t *child)
         return PB_STATUS_GENERIC_ERROR;
     }
 
+    // The zygote reaps its own children.
+    if (NULL == child->zygote)
+    {
+        PB_reap_in_background(child->pid, child->pidfd);
+        child->pidfd = -1;
+    }
+    else
+    {
+        PB_zygote_abandon(child->zygote, child->pid);
+    }
+    child->return_code = PB_DEFAULT_RETURN;
+    child->reaped = true;
     return PB_STATUS_OK;
 }
 
 PB_status_t PB_wait(PB_process_t *child)
+{
+    return PB_wait_timeout(child, -1);
+}
+
+PB_status_t PB_wait_timeout(PB_process_t *child, int timeout_ms)
 {
     if (NULL == child)
     {
         return PB_STATUS_USAGE_ERROR;
     }
 
+    if (child->reaped)
+    {
+        return PB_STATUS_OK;
+    }
+    if (-1 == child->pid)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Child not spawned");
+        child->status = PB_STATUS_NOT_SPAWNED;
+        return PB_STATUS_NOT_SPAWNED;
+    }
+
     int status;
-    if (-1 == waitpid(child->pid, &status, 0))
+    int64_t deadline = timeout_ms < 0 ? PB_NO_DEADLINE : PB_monotonic_ms() + timeout_ms;
+    PB_status_t wait_status = NULL == child->zygote ? wait_child(child, &status, deadline)
+                                                    : PB_zygote_wait(child->zygote, child->pid, &status, deadline);
+    if (PB_STATUS_TIMEOUT == wait_status)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Timed out while waiting for process.");
+        child->status = PB_STATUS_TIMEOUT;
+        return PB_STATUS_TIMEOUT;
+    }
+    if (PB_STATUS_OK != wait_status)
     {
         snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while waiting for process.");
         child->status = PB_STATUS_GENERIC_ERROR;
@@ -339,10 +712,288 @@ PB_status_t PB_wait(PB_process_t *child)
         return PB_STATUS_GENERIC_ERROR;
     }
 
+    child->reaped = true;
+    if (-1 != child->pidfd)
+    {
+        close(child->pidfd);
+        child->pidfd = -1;
+    }
+    return PB_STATUS_OK;
+}
+
+int PB_exit_fd(const PB_process_t *child)
+{
+    return NULL == child ? -1 : child->pidfd;
+}
+
+PB_status_t PB_set_nonblocking(PB_process_t *child, bool nonblocking)
+{
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_TYPE_CHILD != child->type)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Non-blocking mode is only available for child processes.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    child->nonblocking = nonblocking;
+    if (-1 == child->stdin_fd)
+    {
+        return PB_STATUS_OK; // applied by PB_spawn
+    }
+
+    bool stdin_error = set_fd_nonblocking(child->stdin_fd, nonblocking);
+    bool stdout_error = set_fd_nonblocking(child->stdout_fd, nonblocking);
+    bool stderr_error = set_fd_nonblocking(child->stderr_fd, nonblocking);
+    if (stdin_error || stdout_error || stderr_error)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while changing pipes' blocking mode.");
+        child->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_set_transport(PB_process_t *child, PB_transport_t transport)
+{
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_TYPE_CHILD != child->type || -1 != child->stdin_fd)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "The transport can only be chosen for a child, before spawning it.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+#ifndef __linux__
+    if (PB_TRANSPORT_PIPE != transport)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Shared memory transport is only supported on Linux.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+#endif
+
+    child->transport = transport;
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_set_flush_policy(PB_process_t *process, PB_flush_policy_t policy)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_FLUSH_IMMEDIATE != policy && PB_FLUSH_COALESCE != policy)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Unknown flush policy.");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    PB_flush_policy_t previous = process->flush_policy;
+    process->flush_policy = policy;
+    if (PB_FLUSH_COALESCE == previous && PB_FLUSH_IMMEDIATE == policy)
+    {
+        return PB_flush(process);
+    }
     return PB_STATUS_OK;
 }
 
+PB_status_t PB_set_stderr_ring(PB_process_t *child, size_t max_lines)
+{
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_TYPE_CHILD != child->type)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "The stderr ring is only available for child processes.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    PB_drain_stop(child->stderr_drain);
+    child->stderr_drain = NULL;
+    child->stderr_ring_lines = max_lines;
+    if (-1 == child->stderr_fd)
+    {
+        return PB_STATUS_OK; // started by PB_spawn
+    }
+    return PB_drain_spawned(child);
+}
+
+// pipe2(O_CLOEXEC) where available, then the requested capacity if any.
+int PB_open_pipe(int fds[2], size_t size)
+{
+#ifdef __linux__
+    if (-1 == pipe2(fds, O_CLOEXEC))
+    {
+        fds[0] = fds[1] = -1;
+        return 1;
+    }
+#else
+    if (-1 == pipe(fds))
+    {
+        fds[0] = fds[1] = -1;
+        return 1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+#ifdef F_SETPIPE_SZ
+    if (0 != size && (size > INT_MAX || -1 == fcntl(fds[1], F_SETPIPE_SZ, (int)size)))
+    {
+        int error = errno;
+        PB_close_pipe(fds);
+        errno = error;
+        return 1;
+    }
+#else
+    (void)size;
 #endif
+    return 0;
+}
+
+void PB_close_pipe(int fds[2])
+{
+    if (-1 != fds[0])
+    {
+        close(fds[0]);
+        close(fds[1]);
+        fds[0] = fds[1] = -1;
+    }
+}
+
+// Copy of environ with entry added, replacing a variable of the same name.
+char **PB_environment_with(const char *entry)
+{
+    size_t name_length = strcspn(entry, "=") + 1;
+    size_t count = 0;
+    while (NULL != environ[count])
+    {
+        count++;
+    }
+
+    char **envp = (char **)malloc((count + 2) * sizeof(char *));
+    if (NULL == envp)
+    {
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (0 != strncmp(environ[i], entry, name_length))
+        {
+            envp[n++] = environ[i];
+        }
+    }
+    envp[n++] = (char *)entry;
+    envp[n] = NULL;
+    return envp;
+}
+
+// waitpid() with a deadline: the pidfd tells when the child exits, without
+// one (or on other systems) we poll with a growing sleep.
+static PB_status_t wait_child(PB_process_t *child, int *status, int64_t deadline)
+{
+    int sleep_ms = 1;
+    for (;;)
+    {
+        pid_t reaped = waitpid(child->pid, status, PB_NO_DEADLINE == deadline ? 0 : WNOHANG);
+        if (reaped == child->pid)
+        {
+            return PB_STATUS_OK;
+        }
+        if (-1 == reaped)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return PB_STATUS_GENERIC_ERROR;
+        }
+
+        int64_t remaining = deadline - PB_monotonic_ms();
+        if (remaining <= 0)
+        {
+            return PB_STATUS_TIMEOUT;
+        }
+        int timeout_ms = remaining < INT_MAX ? (int)remaining : INT_MAX;
+        if (-1 != child->pidfd)
+        {
+            struct pollfd pfd = {child->pidfd, POLLIN, 0};
+            poll(&pfd, 1, timeout_ms);
+        }
+        else
+        {
+            poll(NULL, 0, sleep_ms < timeout_ms ? sleep_ms : timeout_ms);
+            sleep_ms = sleep_ms < 64 ? 2 * sleep_ms : sleep_ms;
+        }
+    }
+}
+
+int PB_open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0); // close-on-exec already
+    return pidfd < 0 ? -1 : pidfd;
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+// Fresh actions that make duplicates of the pipes for the child, the
+// originals close on exec.
+static void init_stdio_actions(posix_spawn_file_actions_t *actions, const int stdin_pipe[2], const int stdout_pipe[2], const int stderr_pipe[2])
+{
+    const size_t WRITE_SIDE = 1;
+    const size_t READ_SIDE = 0;
+    posix_spawn_file_actions_init(actions);
+    posix_spawn_file_actions_adddup2(actions, stdin_pipe[READ_SIDE], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(actions, stdout_pipe[WRITE_SIDE], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(actions, stderr_pipe[WRITE_SIDE], STDERR_FILENO);
+}
+
+static int set_fd_nonblocking(int fd, bool nonblocking)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (-1 == flags)
+    {
+        return 1;
+    }
+    flags = nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    return -1 == fcntl(fd, F_SETFL, flags) ? 1 : 0;
+}
+
+#endif
+
+PB_status_t PB_poll_exit(PB_process_t *child)
+{
+    PB_status_t status = PB_wait_timeout(child, 0);
+    if (PB_STATUS_TIMEOUT == status)
+    {
+        child->status = PB_STATUS_WOULD_BLOCK;
+        return PB_STATUS_WOULD_BLOCK;
+    }
+    return status;
+}
+
+size_t PB_stderr_dropped(const PB_process_t *child)
+{
+    return NULL == child || NULL == child->stderr_drain ? 0 : PB_drain_dropped(child->stderr_drain);
+}
 
 void PB_clear_error(PB_process_t *process)
 {
@@ -0,0 +1,793 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_buffer.h"
+#include "PB_generic_functions.h"
+#include "PB_internal.h"
+#include "PB_shm.h"
+#include "PB_uring.h"
+#include "process_bridge.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#define PB_LOOP_EVENTS 64
+#define PB_LOOP_VIEWS 64
+#define PB_LOOP_READ_SIZE 16384 // per io_uring read
+#define PB_LOOP_FIXED_READS 64  // registered read buffers, later sources get their own
+#define PB_LOOP_CANCEL_TAG 1    // user_data of cancellations, sources are pointers
+#define PB_LOOP_BACKEND_ENVIRONMENT "PB_LOOP_BACKEND"
+
+typedef enum
+{
+    SOURCE_STDOUT = 0,
+    SOURCE_STDERR = 1,
+    SOURCE_STDIN = 2,
+    SOURCE_WAKE = 3, // eventfd of the shared memory rings
+} source_kind_t;
+
+typedef struct entry_t entry_t;
+
+typedef struct
+{
+    entry_t *entry;
+    source_kind_t kind;
+    bool open;
+    // io_uring backend
+    bool reads;   // completes with data instead of readiness
+    bool armed;   // an operation is in flight
+    int fixed;    // registered buffer index, -1 when buffer is its own
+    char *buffer; // destination of the reads
+} source_t;
+
+struct entry_t
+{
+    PB_process_t *process;
+    PB_loop_callback_t callback;
+    void *user_data;
+    source_t sources[4];
+    bool writing; // EPOLLOUT armed on stdin
+    bool removed;
+    int in_flight; // io_uring operations still pointing at the sources
+    entry_t *next;
+};
+
+struct PB_loop_t
+{
+    PB_loop_backend_t backend;
+    int epoll_fd;
+    PB_uring_t *ring;
+    char *fixed_buffers; // PB_LOOP_FIXED_READS registered slots, or NULL
+    bool fixed_used[PB_LOOP_FIXED_READS];
+    entry_t *entries;
+    entry_t *graveyard; // removed while dispatching, freed after the batch
+    entry_t *cancelled; // removed with io_uring operations in flight
+    bool dispatching;
+    bool stopped;
+};
+
+static bool setup_uring(PB_loop_t *loop);
+static PB_status_t run_epoll(PB_loop_t *loop, int timeout_ms);
+static PB_status_t run_uring(PB_loop_t *loop);
+static entry_t *find_entry(PB_loop_t *loop, PB_process_t *process);
+static int source_fd(const source_t *source);
+static PB_status_t open_source(PB_loop_t *loop, source_t *source);
+static void close_source(PB_loop_t *loop, source_t *source);
+static void arm_source(PB_loop_t *loop, source_t *source);
+static void release_entry(PB_loop_t *loop, entry_t *entry);
+static void free_entry(PB_loop_t *loop, entry_t *entry);
+static void sync_writing(PB_loop_t *loop, entry_t *entry);
+static void dispatch_readable(PB_loop_t *loop, source_t *source, const char *data, int32_t result);
+static void dispatch_writable(PB_loop_t *loop, source_t *source, uint32_t events);
+static void dispatch_wake(PB_loop_t *loop, source_t *source);
+
+//------------------------------------------------------------------------------
+
+PB_loop_t *PB_loop_create(void)
+{
+    const char *backend = getenv(PB_LOOP_BACKEND_ENVIRONMENT);
+    if (NULL != backend && 0 == strcmp(backend, "io_uring"))
+    {
+        return PB_loop_create_backend(PB_LOOP_BACKEND_IO_URING);
+    }
+    return PB_loop_create_backend(PB_LOOP_BACKEND_EPOLL);
+}
+
+PB_loop_t *PB_loop_create_backend(PB_loop_backend_t backend)
+{
+    PB_loop_t *loop = (PB_loop_t *)calloc(1, sizeof(PB_loop_t));
+    if (NULL == loop)
+    {
+        return NULL;
+    }
+
+    loop->epoll_fd = -1;
+    if (PB_LOOP_BACKEND_IO_URING == backend && setup_uring(loop))
+    {
+        loop->backend = PB_LOOP_BACKEND_IO_URING;
+        return loop;
+    }
+
+    // Plain read and write through epoll, also when io_uring is unavailable.
+    loop->backend = PB_LOOP_BACKEND_EPOLL;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == loop->epoll_fd)
+    {
+        free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+PB_loop_backend_t PB_loop_backend(const PB_loop_t *loop)
+{
+    return NULL == loop ? PB_LOOP_BACKEND_EPOLL : loop->backend;
+}
+
+void PB_loop_destroy(PB_loop_t *loop)
+{
+    if (NULL == loop)
+    {
+        return;
+    }
+
+    while (NULL != loop->entries)
+    {
+        PB_loop_remove(loop, loop->entries->process);
+    }
+    while (NULL != loop->graveyard)
+    {
+        entry_t *next = loop->graveyard->next;
+        release_entry(loop, loop->graveyard);
+        loop->graveyard = next;
+    }
+
+    // Cancelled operations still write to the buffers until they complete.
+    while (NULL != loop->cancelled && 0 == PB_uring_enter(loop->ring, -1))
+    {
+        run_uring(loop);
+    }
+    PB_uring_destroy(loop->ring);
+    free(loop->fixed_buffers);
+    if (-1 != loop->epoll_fd)
+    {
+        close(loop->epoll_fd);
+    }
+    free(loop);
+}
+
+PB_status_t PB_loop_add(PB_loop_t *loop, PB_process_t *process, PB_loop_callback_t callback, void *user_data)
+{
+    if (NULL == loop || NULL == process || NULL == callback)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_TYPE_CHILD != process->type || -1 == process->stdout_fd || NULL != find_entry(loop, process))
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Only spawned child processes can be added to a loop, once.");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_STATUS_OK != PB_set_nonblocking(process, true))
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    entry_t *entry = (entry_t *)malloc(sizeof(entry_t));
+    if (NULL == entry)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    entry->process = process;
+    entry->callback = callback;
+    entry->user_data = user_data;
+    entry->writing = false;
+    entry->removed = false;
+    entry->in_flight = 0;
+
+    for (int kind = SOURCE_STDOUT; kind <= SOURCE_WAKE; kind++)
+    {
+        source_t *source = &entry->sources[kind];
+        source->entry = entry;
+        source->kind = (source_kind_t)kind;
+        source->open = false;
+        source->reads = false;
+        source->armed = false;
+        source->fixed = -1;
+        source->buffer = NULL;
+    }
+
+    // With rings, the peer signals the wake fd on every read and write.
+    int last = NULL == process->shm ? SOURCE_STDIN : SOURCE_WAKE;
+    for (int kind = SOURCE_STDOUT; kind <= last; kind++)
+    {
+        source_t *source = &entry->sources[kind];
+        if (SOURCE_STDERR == kind && NULL != process->stderr_drain)
+        {
+            continue; // its own thread reads it
+        }
+
+        if (PB_STATUS_OK != open_source(loop, source))
+        {
+            for (int i = SOURCE_STDOUT; i < kind; i++)
+            {
+                close_source(loop, &entry->sources[i]);
+            }
+            free_entry(loop, entry);
+            return PB_STATUS_GENERIC_ERROR;
+        }
+    }
+
+    if (NULL != process->shm)
+    {
+        PB_shm_watch(process->shm, true);
+    }
+    process->loop_reads = entry->sources[SOURCE_STDOUT].reads;
+    entry->next = loop->entries;
+    loop->entries = entry;
+    sync_writing(loop, entry);
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_loop_remove(PB_loop_t *loop, PB_process_t *process)
+{
+    if (NULL == loop || NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    entry_t **link = &loop->entries;
+    while (NULL != *link && (*link)->process != process)
+    {
+        link = &(*link)->next;
+    }
+    if (NULL == *link)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    entry_t *entry = *link;
+    *link = entry->next;
+    for (int kind = SOURCE_STDOUT; kind <= SOURCE_WAKE; kind++)
+    {
+        close_source(loop, &entry->sources[kind]);
+    }
+    if (NULL != process->shm)
+    {
+        PB_shm_watch(process->shm, false);
+    }
+    process->loop_reads = false;
+    entry->removed = true;
+    if (PB_LOOP_BACKEND_IO_URING == loop->backend && !loop->dispatching)
+    {
+        PB_uring_enter(loop->ring, 0); // cancellations go out before the caller closes the pipes
+    }
+
+    // Events of this batch may still point at the entry.
+    if (loop->dispatching)
+    {
+        entry->next = loop->graveyard;
+        loop->graveyard = entry;
+    }
+    else
+    {
+        release_entry(loop, entry);
+    }
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_loop_run_once(PB_loop_t *loop, int timeout_ms)
+{
+    if (NULL == loop)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    // Sends issued since the last iteration may have queued data.
+    for (entry_t *entry = loop->entries; NULL != entry; entry = entry->next)
+    {
+        sync_writing(loop, entry);
+    }
+
+    if (PB_LOOP_BACKEND_IO_URING != loop->backend)
+    {
+        return run_epoll(loop, timeout_ms);
+    }
+
+    // Every idle source gets an operation, all submitted by the one io_uring_enter.
+    for (entry_t *entry = loop->entries; NULL != entry; entry = entry->next)
+    {
+        for (int kind = SOURCE_STDOUT; kind <= SOURCE_WAKE; kind++)
+        {
+            arm_source(loop, &entry->sources[kind]);
+        }
+    }
+    if (-1 == PB_uring_enter(loop->ring, timeout_ms))
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    return run_uring(loop);
+}
+
+PB_status_t PB_loop_run(PB_loop_t *loop)
+{
+    if (NULL == loop)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    loop->stopped = false;
+    while (!loop->stopped && NULL != loop->entries)
+    {
+        PB_status_t status = PB_loop_run_once(loop, -1);
+        if (PB_STATUS_OK != status && PB_STATUS_TIMEOUT != status)
+        {
+            return status;
+        }
+    }
+    return PB_STATUS_OK;
+}
+
+void PB_loop_stop(PB_loop_t *loop)
+{
+    if (NULL != loop)
+    {
+        loop->stopped = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// The ring, plus registered read buffers when the kernel accepts them.
+static bool setup_uring(PB_loop_t *loop)
+{
+    loop->ring = PB_uring_create();
+    if (NULL == loop->ring)
+    {
+        return false;
+    }
+
+    loop->fixed_buffers = (char *)malloc((size_t)PB_LOOP_FIXED_READS * PB_LOOP_READ_SIZE);
+    if (NULL == loop->fixed_buffers)
+    {
+        return true; // reads go to buffers of their own
+    }
+    struct iovec iov[PB_LOOP_FIXED_READS];
+    for (int i = 0; i < PB_LOOP_FIXED_READS; i++)
+    {
+        iov[i].iov_base = loop->fixed_buffers + (size_t)i * PB_LOOP_READ_SIZE;
+        iov[i].iov_len = PB_LOOP_READ_SIZE;
+    }
+    if (!PB_uring_register_buffers(loop->ring, iov, PB_LOOP_FIXED_READS))
+    {
+        free(loop->fixed_buffers);
+        loop->fixed_buffers = NULL;
+    }
+    return true;
+}
+
+static PB_status_t run_epoll(PB_loop_t *loop, int timeout_ms)
+{
+    struct epoll_event events[PB_LOOP_EVENTS];
+    int ready = epoll_wait(loop->epoll_fd, events, PB_LOOP_EVENTS, timeout_ms);
+    if (-1 == ready)
+    {
+        return EINTR == errno ? PB_STATUS_OK : PB_STATUS_GENERIC_ERROR;
+    }
+    if (0 == ready)
+    {
+        return PB_STATUS_TIMEOUT;
+    }
+
+    loop->dispatching = true;
+    for (int i = 0; i < ready; i++)
+    {
+        source_t *source = (source_t *)events[i].data.ptr;
+        if (source->entry->removed || !source->open)
+        {
+            continue;
+        }
+        if (SOURCE_STDIN == source->kind)
+        {
+            dispatch_writable(loop, source, events[i].events);
+        }
+        else if (SOURCE_WAKE == source->kind)
+        {
+            dispatch_wake(loop, source);
+        }
+        else
+        {
+            dispatch_readable(loop, source, NULL, 0);
+        }
+    }
+    loop->dispatching = false;
+
+    while (NULL != loop->graveyard)
+    {
+        entry_t *next = loop->graveyard->next;
+        free_entry(loop, loop->graveyard);
+        loop->graveyard = next;
+    }
+    return PB_STATUS_OK;
+}
+
+// Dispatches the completions reaped by the last io_uring_enter.
+static PB_status_t run_uring(PB_loop_t *loop)
+{
+    bool dispatched = false;
+    uint64_t tag = 0;
+    int32_t result = 0;
+
+    loop->dispatching = true;
+    while (PB_uring_complete(loop->ring, &tag, &result))
+    {
+        if (PB_LOOP_CANCEL_TAG == tag)
+        {
+            continue;
+        }
+        source_t *source = (source_t *)(uintptr_t)tag;
+        entry_t *entry = source->entry;
+        source->armed = false;
+        entry->in_flight--;
+        if (entry->removed || !source->open)
+        {
+            continue;
+        }
+
+        dispatched = true;
+        if (source->reads)
+        {
+            dispatch_readable(loop, source, source->buffer, result);
+        }
+        else if (SOURCE_STDIN == source->kind)
+        {
+            dispatch_writable(loop, source, result < 0 ? EPOLLERR : (uint32_t)result);
+        }
+        else if (SOURCE_WAKE == source->kind)
+        {
+            dispatch_wake(loop, source);
+        }
+        else
+        {
+            dispatch_readable(loop, source, NULL, 0);
+        }
+    }
+    loop->dispatching = false;
+
+    while (NULL != loop->graveyard)
+    {
+        entry_t *next = loop->graveyard->next;
+        release_entry(loop, loop->graveyard);
+        loop->graveyard = next;
+    }
+    entry_t **link = &loop->cancelled;
+    while (NULL != *link)
+    {
+        entry_t *entry = *link;
+        if (0 == entry->in_flight)
+        {
+            *link = entry->next;
+            free_entry(loop, entry);
+        }
+        else
+        {
+            link = &entry->next;
+        }
+    }
+    return dispatched ? PB_STATUS_OK : PB_STATUS_TIMEOUT;
+}
+
+static entry_t *find_entry(PB_loop_t *loop, PB_process_t *process)
+{
+    for (entry_t *entry = loop->entries; NULL != entry; entry = entry->next)
+    {
+        if (entry->process == process)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static int source_fd(const source_t *source)
+{
+    switch (source->kind)
+    {
+    case SOURCE_STDOUT:
+        return source->entry->process->stdout_fd;
+    case SOURCE_STDERR:
+        return source->entry->process->stderr_fd;
+    case SOURCE_WAKE:
+        return PB_shm_wake_fd(source->entry->process->shm);
+    default:
+        return source->entry->process->stdin_fd;
+    }
+}
+
+// Watches one fd: an epoll registration, or for io_uring a read buffer.
+static PB_status_t open_source(PB_loop_t *loop, source_t *source)
+{
+    PB_process_t *process = source->entry->process;
+    if (PB_LOOP_BACKEND_IO_URING != loop->backend)
+    {
+        // stdin starts with no interest, EPOLLOUT is armed only while sends are queued.
+        struct epoll_event event = {.events = SOURCE_STDIN == source->kind ? 0 : EPOLLIN, .data.ptr = source};
+        if (-1 == epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source_fd(source), &event))
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Error while adding pipes to epoll.");
+            process->status = PB_STATUS_GENERIC_ERROR;
+            return PB_STATUS_GENERIC_ERROR;
+        }
+        source->open = true;
+        return PB_STATUS_OK;
+    }
+
+    // Pipes are read by the ring itself; stdin and the rings only report readiness.
+    source->reads = NULL == process->shm && SOURCE_STDIN != source->kind;
+    if (source->reads)
+    {
+        for (int i = 0; NULL != loop->fixed_buffers && i < PB_LOOP_FIXED_READS && -1 == source->fixed; i++)
+        {
+            if (!loop->fixed_used[i])
+            {
+                loop->fixed_used[i] = true;
+                source->fixed = i;
+                source->buffer = loop->fixed_buffers + (size_t)i * PB_LOOP_READ_SIZE;
+            }
+        }
+        if (NULL == source->buffer && NULL == (source->buffer = (char *)malloc(PB_LOOP_READ_SIZE)))
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+            process->status = PB_STATUS_GENERIC_ERROR;
+            return PB_STATUS_GENERIC_ERROR;
+        }
+
+        // On a non-blocking pipe, io_uring completes with EAGAIN instead of waiting.
+        int fd = source_fd(source);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    }
+    source->open = true;
+    return PB_STATUS_OK;
+}
+
+static void close_source(PB_loop_t *loop, source_t *source)
+{
+    if (!source->open)
+    {
+        return;
+    }
+
+    if (PB_LOOP_BACKEND_IO_URING != loop->backend)
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source_fd(source), NULL);
+    }
+    else
+    {
+        if (source->armed)
+        {
+            PB_uring_cancel(loop->ring, (uint64_t)(uintptr_t)source, PB_LOOP_CANCEL_TAG);
+        }
+        if (source->reads)
+        {
+            int fd = source_fd(source);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+    source->open = false;
+}
+
+// Queues the next io_uring operation of an idle source: a read, or a poll
+// for readiness. stdin is only polled while sends are queued.
+static void arm_source(PB_loop_t *loop, source_t *source)
+{
+    if (!source->open || source->armed || (SOURCE_STDIN == source->kind && !source->entry->writing))
+    {
+        return;
+    }
+
+    uint64_t tag = (uint64_t)(uintptr_t)source;
+    bool queued = source->reads ? PB_uring_read(loop->ring, source_fd(source), source->buffer, PB_LOOP_READ_SIZE, source->fixed, tag)
+                                : PB_uring_poll(loop->ring, source_fd(source), SOURCE_STDIN == source->kind ? POLLOUT : POLLIN, tag);
+    if (queued)
+    {
+        source->armed = true;
+        source->entry->in_flight++;
+    }
+}
+
+// Frees the entry, or keeps it until its cancelled operations complete.
+static void release_entry(PB_loop_t *loop, entry_t *entry)
+{
+    if (entry->in_flight > 0)
+    {
+        entry->next = loop->cancelled;
+        loop->cancelled = entry;
+        return;
+    }
+    free_entry(loop, entry);
+}
+
+static void free_entry(PB_loop_t *loop, entry_t *entry)
+{
+    for (int kind = SOURCE_STDOUT; kind <= SOURCE_WAKE; kind++)
+    {
+        source_t *source = &entry->sources[kind];
+        if (source->fixed >= 0)
+        {
+            loop->fixed_used[source->fixed] = false;
+        }
+        else
+        {
+            free(source->buffer);
+        }
+    }
+    free(entry);
+}
+
+// Arms EPOLLOUT on stdin exactly while the process has queued sends.
+// Rings report free room through the wake fd instead.
+static void sync_writing(PB_loop_t *loop, entry_t *entry)
+{
+    if (NULL != entry->process->shm)
+    {
+        return;
+    }
+
+    source_t *source = &entry->sources[SOURCE_STDIN];
+    PB_buffer_t *queue = entry->process->send_buffer;
+    bool pending = NULL != queue && PB_buffer_length(queue) > 0;
+    if (!source->open || pending == entry->writing)
+    {
+        return;
+    }
+    if (PB_LOOP_BACKEND_IO_URING == loop->backend)
+    {
+        entry->writing = pending; // picked up by arm_source
+        return;
+    }
+
+    struct epoll_event event = {.events = pending ? EPOLLOUT : 0, .data.ptr = source};
+    if (0 == epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source_fd(source), &event))
+    {
+        entry->writing = pending;
+    }
+}
+
+// Hands every complete message to the callback. data holds what an io_uring
+// read completed with (result bytes, EOF when not positive); without it, one
+// read happens here.
+static void dispatch_readable(PB_loop_t *loop, source_t *source, const char *data, int32_t result)
+{
+    entry_t *entry = source->entry;
+    bool is_err = SOURCE_STDERR == source->kind;
+    PB_event_t event = is_err ? PB_EVENT_ERR_MESSAGE : PB_EVENT_MESSAGE;
+    if (NULL != data && (-EAGAIN == result || -EINTR == result))
+    {
+        return; // the next iteration reads again
+    }
+
+    PB_message_view_t views[PB_LOOP_VIEWS];
+    size_t count = 0;
+    bool eof = NULL != data && result <= 0;
+    size_t length = NULL != data && result > 0 ? (size_t)result : 0;
+    do
+    {
+        PB_status_t status = NULL == data ? PB_receive_views(entry->process, is_err, views, PB_LOOP_VIEWS, &count, 0, &eof)
+                                          : PB_receive_feed(entry->process, is_err, data, length, eof, views, PB_LOOP_VIEWS, &count);
+        length = 0; // appended once, later rounds only take
+        if (PB_STATUS_OK != status)
+        {
+            eof = PB_STATUS_TIMEOUT != status;
+            break;
+        }
+        for (size_t i = 0; i < count && !entry->removed; i++)
+        {
+            entry->callback(loop, entry->process, event, views[i].data, views[i].length, entry->user_data);
+        }
+    } while (count == PB_LOOP_VIEWS && !entry->removed && (NULL != data || !eof));
+
+    if (eof && !entry->removed)
+    {
+        close_source(loop, source);
+        if (!is_err)
+        {
+            entry->callback(loop, entry->process, PB_EVENT_CLOSED, NULL, 0, entry->user_data);
+        }
+    }
+}
+
+static void dispatch_writable(PB_loop_t *loop, source_t *source, uint32_t events)
+{
+    entry_t *entry = source->entry;
+    if ((events & EPOLLERR) || PB_STATUS_GENERIC_ERROR == PB_flush(entry->process))
+    {
+        close_source(loop, source); // reader is gone, stdout EOF reports it
+        return;
+    }
+    sync_writing(loop, entry);
+}
+
+// The peer wrote to or read from a ring: read what came, write what waits.
+static void dispatch_wake(PB_loop_t *loop, source_t *source)
+{
+    entry_t *entry = source->entry;
+    PB_shm_clear_wake(entry->process->shm);
+    if (entry->sources[SOURCE_STDOUT].open)
+    {
+        dispatch_readable(loop, &entry->sources[SOURCE_STDOUT], NULL, 0);
+    }
+    if (!entry->removed)
+    {
+        PB_flush(entry->process); // errors surface as stdout EOF
+    }
+}
+
+#else // no epoll
+
+PB_loop_t *PB_loop_create(void)
+{
+    return NULL;
+}
+
+PB_loop_t *PB_loop_create_backend(PB_loop_backend_t backend)
+{
+    (void)backend;
+    return NULL;
+}
+
+PB_loop_backend_t PB_loop_backend(const PB_loop_t *loop)
+{
+    (void)loop;
+    return PB_LOOP_BACKEND_EPOLL;
+}
+
+void PB_loop_destroy(PB_loop_t *loop)
+{
+    (void)loop;
+}
+
+PB_status_t PB_loop_add(PB_loop_t *loop, PB_process_t *process, PB_loop_callback_t callback, void *user_data)
+{
+    (void)loop;
+    (void)process;
+    (void)callback;
+    (void)user_data;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_loop_remove(PB_loop_t *loop, PB_process_t *process)
+{
+    (void)loop;
+    (void)process;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_loop_run_once(PB_loop_t *loop, int timeout_ms)
+{
+    (void)loop;
+    (void)timeout_ms;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_loop_run(PB_loop_t *loop)
+{
+    (void)loop;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+void PB_loop_stop(PB_loop_t *loop)
+{
+    (void)loop;
+}
+
+#endif
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_generic_functions.h"
+#include "process_bridge.h"
+
+#ifdef __linux__
+
+typedef struct request_t request_t;
+struct request_t
+{
+    char *message;
+    PB_pool_callback_t callback;
+    void *user_data;
+    request_t *next;
+};
+
+typedef struct
+{
+    PB_pool_t *pool;
+    PB_process_t *process;
+    request_t *current; // lock-step protocol: one request in flight
+    size_t served;
+    bool alive;
+} worker_t;
+
+struct PB_pool_t
+{
+    PB_loop_t *loop;
+    worker_t *workers;
+    size_t n_workers;
+    request_t *queue_head; // waiting for an idle worker
+    request_t *queue_tail;
+    size_t outstanding; // queued + in flight
+};
+
+static void on_event(PB_loop_t *loop, PB_process_t *process, PB_event_t event, const char *data, size_t length, void *user_data);
+static worker_t *pick_worker(PB_pool_t *pool);
+static void start_request(worker_t *worker, request_t *request);
+static void finish_request(PB_pool_t *pool, request_t *request, PB_status_t status, const char *response, size_t length);
+static void fail_queue(PB_pool_t *pool);
+
+//------------------------------------------------------------------------------
+
+PB_pool_t *PB_pool_create(const char *command, size_t n_workers)
+{
+    if (NULL == command || 0 == n_workers)
+    {
+        return NULL;
+    }
+
+    PB_pool_t *pool = (PB_pool_t *)malloc(sizeof(PB_pool_t));
+    if (NULL == pool)
+    {
+        return NULL;
+    }
+    pool->workers = (worker_t *)calloc(n_workers, sizeof(worker_t));
+    pool->loop = PB_loop_create();
+    pool->n_workers = 0;
+    pool->queue_head = NULL;
+    pool->queue_tail = NULL;
+    pool->outstanding = 0;
+    if (NULL == pool->workers || NULL == pool->loop)
+    {
+        PB_pool_destroy(pool);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n_workers; i++)
+    {
+        worker_t *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->process = PB_create(PB_TYPE_CHILD);
+        pool->n_workers++;
+        if (NULL == worker->process || PB_STATUS_OK != PB_spawn(worker->process, command))
+        {
+            PB_pool_destroy(pool);
+            return NULL;
+        }
+        worker->alive = true;
+        if (PB_STATUS_OK != PB_loop_add(pool->loop, worker->process, on_event, worker))
+        {
+            PB_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void PB_pool_destroy(PB_pool_t *pool)
+{
+    if (NULL == pool)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < pool->n_workers; i++)
+    {
+        worker_t *worker = &pool->workers[i];
+        if (NULL == worker->process)
+        {
+            continue;
+        }
+        PB_loop_remove(pool->loop, worker->process);
+        if (worker->alive)
+        {
+            PB_despawn(worker->process);
+            PB_wait(worker->process);
+        }
+        if (NULL != worker->current)
+        {
+            finish_request(pool, worker->current, PB_STATUS_TERMINATED, NULL, 0);
+        }
+        PB_destroy(worker->process);
+    }
+    fail_queue(pool);
+    PB_loop_destroy(pool->loop);
+    free(pool->workers);
+    free(pool);
+}
+
+PB_status_t PB_pool_submit(PB_pool_t *pool, const char *request, PB_pool_callback_t callback, void *user_data)
+{
+    if (NULL == pool || NULL == request || NULL == callback)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    // Without a live worker the request would wait forever.
+    bool serving = false;
+    for (size_t i = 0; i < pool->n_workers && !serving; i++)
+    {
+        serving = pool->workers[i].alive;
+    }
+    if (!serving)
+    {
+        return PB_STATUS_TERMINATED;
+    }
+
+    request_t *entry = (request_t *)malloc(sizeof(request_t));
+    char *message = PB_string_clone(request, strlen(request));
+    if (NULL == entry || NULL == message)
+    {
+        free(entry);
+        free(message);
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    entry->message = message;
+    entry->callback = callback;
+    entry->user_data = user_data;
+    entry->next = NULL;
+    pool->outstanding++;
+
+    worker_t *worker = pick_worker(pool);
+    if (NULL != worker)
+    {
+        start_request(worker, entry);
+        return PB_STATUS_OK;
+    }
+
+    if (NULL == pool->queue_tail)
+    {
+        pool->queue_head = entry;
+    }
+    else
+    {
+        pool->queue_tail->next = entry;
+    }
+    pool->queue_tail = entry;
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_pool_run_once(PB_pool_t *pool, int timeout_ms)
+{
+    if (NULL == pool)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+    return PB_loop_run_once(pool->loop, timeout_ms);
+}
+
+PB_status_t PB_pool_wait(PB_pool_t *pool)
+{
+    if (NULL == pool)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    while (pool->outstanding > 0)
+    {
+        PB_status_t status = PB_loop_run_once(pool->loop, -1);
+        if (PB_STATUS_OK != status && PB_STATUS_TIMEOUT != status)
+        {
+            return status;
+        }
+    }
+    return PB_STATUS_OK;
+}
+
+size_t PB_pool_outstanding(const PB_pool_t *pool)
+{
+    return NULL == pool ? 0 : pool->outstanding;
+}
+
+//------------------------------------------------------------------------------
+
+static void on_event(PB_loop_t *loop, PB_process_t *process, PB_event_t event, const char *data, size_t length, void *user_data)
+{
+    worker_t *worker = (worker_t *)user_data;
+    PB_pool_t *pool = worker->pool;
+
+    switch (event)
+    {
+    case PB_EVENT_MESSAGE:
+        if (NULL != worker->current)
+        {
+            request_t *request = worker->current;
+            worker->current = NULL;
+            worker->served++;
+            finish_request(pool, request, PB_STATUS_OK, data, length);
+        }
+        break;
+    case PB_EVENT_CLOSED:
+        // The worker died, or is about to: its request fails, the others keep
+        // serving. PB_despawn closes its pipes and reaps it, in the background
+        // if it has not exited yet.
+        PB_loop_remove(loop, process);
+        worker->alive = false;
+        PB_despawn(process);
+        if (NULL != worker->current)
+        {
+            request_t *request = worker->current;
+            worker->current = NULL;
+            finish_request(pool, request, PB_STATUS_TERMINATED, NULL, 0);
+        }
+        for (size_t i = 0; i < pool->n_workers; i++)
+        {
+            if (pool->workers[i].alive)
+            {
+                return;
+            }
+        }
+        fail_queue(pool); // nobody left to serve the queue
+        return;
+    default:
+        return; // stderr is drained and dropped
+    }
+
+    // Keep the worker busy with the oldest waiting request.
+    while (NULL != pool->queue_head && worker->alive && NULL == worker->current)
+    {
+        request_t *next = pool->queue_head;
+        pool->queue_head = next->next;
+        if (NULL == pool->queue_head)
+        {
+            pool->queue_tail = NULL;
+        }
+        next->next = NULL;
+        start_request(worker, next);
+    }
+}
+
+// Least-loaded idle worker: among the idle ones, the one that served the least.
+static worker_t *pick_worker(PB_pool_t *pool)
+{
+    worker_t *best = NULL;
+    for (size_t i = 0; i < pool->n_workers; i++)
+    {
+        worker_t *worker = &pool->workers[i];
+        if (worker->alive && NULL == worker->current && (NULL == best || worker->served < best->served))
+        {
+            best = worker;
+        }
+    }
+    return best;
+}
+
+// A broken pipe is not reported here: the stdout EOF of the dying worker
+// fails the request through its callback, once.
+static void start_request(worker_t *worker, request_t *request)
+{
+    worker->current = request;
+    PB_try_send(worker->process, request->message);
+}
+
+static void finish_request(PB_pool_t *pool, request_t *request, PB_status_t status, const char *response, size_t length)
+{
+    pool->outstanding--;
+    request->callback(pool, status, response, length, request->user_data);
+    free(request->message);
+    free(request);
+}
+
+static void fail_queue(PB_pool_t *pool)
+{
+    while (NULL != pool->queue_head)
+    {
+        request_t *request = pool->queue_head;
+        pool->queue_head = request->next;
+        finish_request(pool, request, PB_STATUS_TERMINATED, NULL, 0);
+    }
+    pool->queue_tail = NULL;
+}
+
+#else // no event loop
+
+PB_pool_t *PB_pool_create(const char *command, size_t n_workers)
+{
+    (void)command;
+    (void)n_workers;
+    return NULL;
+}
+
+void PB_pool_destroy(PB_pool_t *pool)
+{
+    (void)pool;
+}
+
+PB_status_t PB_pool_submit(PB_pool_t *pool, const char *request, PB_pool_callback_t callback, void *user_data)
+{
+    (void)pool;
+    (void)request;
+    (void)callback;
+    (void)user_data;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_pool_run_once(PB_pool_t *pool, int timeout_ms)
+{
+    (void)pool;
+    (void)timeout_ms;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_pool_wait(PB_pool_t *pool)
+{
+    (void)pool;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+size_t PB_pool_outstanding(const PB_pool_t *pool)
+{
+    (void)pool;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+
+#include "PB_internal.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PB_REAPER_POLL_MS 100 // for children without a pidfd
+
+typedef struct
+{
+    pid_t pid;
+    int pidfd; // -1: polled with waitpid(WNOHANG)
+} orphan_t;
+
+// One detached thread for the whole process, started by the first orphan.
+static pthread_mutex_t reaper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static orphan_t *orphans = NULL;
+static size_t orphans_count = 0;
+static size_t orphans_capacity = 0;
+static int reaper_wake[2] = {-1, -1};
+static bool reaper_started = false;
+
+static void *reaper_thread(void *argument);
+static void reap_ready(const struct pollfd *pfds, size_t count);
+
+//------------------------------------------------------------------------------
+
+void PB_reap_in_background(pid_t pid, int pidfd)
+{
+    pthread_mutex_lock(&reaper_mutex);
+    if (!reaper_started)
+    {
+        pthread_t thread;
+        if (PB_open_pipe(reaper_wake, 0) || 0 != pthread_create(&thread, NULL, reaper_thread, NULL))
+        {
+            PB_close_pipe(reaper_wake);
+            pthread_mutex_unlock(&reaper_mutex);
+            close(pidfd);
+            return; // left a zombie until we exit, nothing better to do
+        }
+        fcntl(reaper_wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(reaper_wake[1], F_SETFL, O_NONBLOCK);
+        pthread_detach(thread);
+        reaper_started = true;
+    }
+
+    if (orphans_count == orphans_capacity)
+    {
+        size_t capacity = 0 == orphans_capacity ? 16 : 2 * orphans_capacity;
+        orphan_t *grown = (orphan_t *)realloc(orphans, capacity * sizeof(orphan_t));
+        if (NULL == grown)
+        {
+            pthread_mutex_unlock(&reaper_mutex);
+            close(pidfd);
+            return;
+        }
+        orphans = grown;
+        orphans_capacity = capacity;
+    }
+    orphans[orphans_count].pid = pid;
+    orphans[orphans_count].pidfd = pidfd;
+    orphans_count++;
+    pthread_mutex_unlock(&reaper_mutex);
+
+    if (1 != write(reaper_wake[1], "", 1))
+    {
+        // full pipe: the thread already has a wake-up pending
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void *reaper_thread(void *argument)
+{
+    (void)argument;
+    struct pollfd *pfds = NULL;
+    size_t pfds_capacity = 0;
+
+    for (;;)
+    {
+        // Snapshot: the wake pipe first, then one entry per orphan.
+        pthread_mutex_lock(&reaper_mutex);
+        if (orphans_count + 1 > pfds_capacity)
+        {
+            struct pollfd *grown = (struct pollfd *)realloc(pfds, (orphans_count + 1) * sizeof(struct pollfd));
+            if (NULL != grown)
+            {
+                pfds = grown;
+                pfds_capacity = orphans_count + 1;
+            }
+        }
+        if (NULL == pfds)
+        {
+            pthread_mutex_unlock(&reaper_mutex);
+            poll(NULL, 0, PB_REAPER_POLL_MS);
+            continue;
+        }
+        size_t count = orphans_count + 1 <= pfds_capacity ? orphans_count : pfds_capacity - 1;
+        int timeout_ms = -1;
+        pfds[0].fd = reaper_wake[0];
+        pfds[0].events = POLLIN;
+        for (size_t i = 0; i < count; i++)
+        {
+            pfds[i + 1].fd = orphans[i].pidfd; // poll() skips negative fds
+            pfds[i + 1].events = POLLIN;
+            pfds[i + 1].revents = 0;
+            if (-1 == orphans[i].pidfd)
+            {
+                timeout_ms = PB_REAPER_POLL_MS;
+            }
+        }
+        pthread_mutex_unlock(&reaper_mutex);
+
+        if (-1 == poll(pfds, count + 1, timeout_ms))
+        {
+            continue;
+        }
+        if (pfds[0].revents)
+        {
+            char drain[64];
+            while (read(reaper_wake[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        reap_ready(pfds + 1, count);
+    }
+    return NULL;
+}
+
+// Entries past count were added after the snapshot: next round.
+static void reap_ready(const struct pollfd *pfds, size_t count)
+{
+    pthread_mutex_lock(&reaper_mutex);
+    for (size_t i = count; i-- > 0;)
+    {
+        if (-1 != orphans[i].pidfd && 0 == pfds[i].revents)
+        {
+            continue;
+        }
+        int status;
+        pid_t reaped = waitpid(orphans[i].pid, &status, WNOHANG);
+        if (0 == reaped || (-1 == reaped && EINTR == errno))
+        {
+            continue;
+        }
+        if (-1 != orphans[i].pidfd)
+        {
+            close(orphans[i].pidfd);
+        }
+        orphans[i] = orphans[--orphans_count];
+    }
+    pthread_mutex_unlock(&reaper_mutex);
+}
+
+#endif
@@ -1,42 +1,217 @@
-
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
+#include "PB_buffer.h"
+#include "PB_drain.h"
 #include "PB_generic_functions.h"
+#include "PB_internal.h"
 #include "process_bridge.h"
 
-static PB_status_t receive_dispatcher(PB_process_t *process, char *message, size_t size, bool is_err);
+static PB_status_t receive_dispatcher(PB_process_t *process, void *mailbox, size_t size, size_t *length, bool is_err, int timeout_ms);
+
+static PB_status_t receive_from_parent(PB_process_t *process, void *mailbox, size_t size, size_t *length, int64_t deadline);
+static PB_status_t receive_from_child(PB_process_t *process, void *mailbox, size_t size, size_t *length, bool is_err, int64_t deadline);
+
+static PB_status_t receive_line(PB_process_t *process, char *mailbox, size_t size, bool is_err, const char *source, int64_t deadline);
+static PB_status_t receive_frame(PB_process_t *process, void *mailbox, size_t size, size_t *length, const char *source, int64_t deadline);
+
+static size_t take_messages(PB_process_t *process, PB_buffer_t *buffer, bool is_err, PB_message_view_t *views, size_t max_views, bool flush);
 
-static PB_status_t receive_from_parent(PB_process_t *process, char *message, size_t size);
-static PB_status_t receive_from_child(PB_process_t *process, char *message, size_t size, bool is_err);
+static PB_buffer_t *get_buffer(PB_process_t *process, bool is_err);
+static PB_status_t fill_buffer(PB_process_t *process, PB_buffer_t *buffer, bool is_err, size_t min_capacity, const char *source, int64_t deadline, bool *eof);
+static PB_status_t read_some(PB_process_t *process, bool is_err, char *destination, size_t size, int timeout_ms, size_t *bytes_read);
 
 //------------------------------------------------------------------------------
 
 PB_status_t PB_receive(PB_process_t *process, char *mailbox, size_t size)
 {
-    return receive_dispatcher(process, mailbox, size, false);
+    return receive_dispatcher(process, mailbox, size, NULL, false, -1);
 }
 
 PB_status_t PB_receive_err(PB_process_t *process, char *mailbox, size_t size)
 {
-    return receive_dispatcher(process, mailbox, size, true);
+    return receive_dispatcher(process, mailbox, size, NULL, true, -1);
+}
+
+PB_status_t PB_receive_timeout(PB_process_t *process, char *mailbox, size_t size, int timeout_ms)
+{
+    return receive_dispatcher(process, mailbox, size, NULL, false, timeout_ms);
+}
+
+PB_status_t PB_receive_err_timeout(PB_process_t *process, char *mailbox, size_t size, int timeout_ms)
+{
+    return receive_dispatcher(process, mailbox, size, NULL, true, timeout_ms);
+}
+
+PB_status_t PB_try_receive(PB_process_t *process, char *mailbox, size_t size)
+{
+    PB_status_t status = receive_dispatcher(process, mailbox, size, NULL, false, 0);
+    if (PB_STATUS_TIMEOUT == status)
+    {
+        process->status = PB_STATUS_WOULD_BLOCK;
+        return PB_STATUS_WOULD_BLOCK;
+    }
+    return status;
+}
+
+PB_status_t PB_try_receive_bytes(PB_process_t *process, void *mailbox, size_t size, size_t *length)
+{
+    PB_status_t status = PB_receive_bytes_timeout(process, mailbox, size, length, 0);
+    if (PB_STATUS_TIMEOUT == status)
+    {
+        process->status = PB_STATUS_WOULD_BLOCK;
+        return PB_STATUS_WOULD_BLOCK;
+    }
+    return status;
+}
+
+PB_status_t PB_receive_bytes(PB_process_t *process, void *mailbox, size_t size, size_t *length)
+{
+    return PB_receive_bytes_timeout(process, mailbox, size, length, -1);
+}
+
+PB_status_t PB_receive_bytes_timeout(PB_process_t *process, void *mailbox, size_t size, size_t *length, int timeout_ms)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_FRAMING_LENGTH_PREFIXED != process->framing || NULL == length)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Receiving bytes needs a framed process and a length pointer");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    return receive_dispatcher(process, mailbox, size, length, false, timeout_ms);
+}
+
+PB_status_t PB_receive_many(PB_process_t *process, PB_message_view_t *views, size_t max_views, size_t *count)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (NULL == views || NULL == count)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Views or count argument is NULL in PB_receive_many call");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    return PB_receive_views(process, false, views, max_views, count, -1, NULL);
+}
+
+// Backs PB_receive_many: returns the complete messages already buffered, or
+// does one read (waiting up to timeout_ms) if there are none. With a non-NULL
+// eof, end of stream is reported there instead of as an error.
+PB_status_t PB_receive_views(PB_process_t *process, bool is_err, PB_message_view_t *views, size_t max_views, size_t *count, int timeout_ms, bool *eof)
+{
+    *count = 0;
+    if (NULL != eof)
+    {
+        *eof = false;
+    }
+
+    if (PB_TYPE_PARENT != process->type && PB_TYPE_CHILD != process->type)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Not implemented");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    PB_buffer_t *buffer = get_buffer(process, is_err);
+    if (NULL == buffer)
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    *count = take_messages(process, buffer, is_err, views, max_views, false);
+    if (*count > 0 || 0 == max_views)
+    {
+        return PB_STATUS_OK;
+    }
+
+    // Nothing complete yet: one read, with room for at least as much as is pending.
+    const char *source = PB_TYPE_PARENT == process->type ? "stdin" : (is_err ? "child's stderr" : "child's stdout");
+    size_t pending = PB_buffer_length(buffer);
+    size_t min_capacity = 2 * pending > PB_BUFFER_SIZE_DEFAULT ? 2 * pending : PB_BUFFER_SIZE_DEFAULT;
+    int64_t deadline = timeout_ms < 0 ? PB_NO_DEADLINE : PB_monotonic_ms() + timeout_ms;
+    bool reached_eof = false;
+    PB_status_t status = fill_buffer(process, buffer, is_err, min_capacity, source, deadline, &reached_eof);
+    if (PB_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    // A trailing line without newline still gets its NUL terminator.
+    size_t space = 0;
+    if (reached_eof && NULL == PB_buffer_prepare(buffer, PB_buffer_length(buffer) + 1, &space))
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    *count = take_messages(process, buffer, is_err, views, max_views, reached_eof);
+    if (NULL != eof)
+    {
+        *eof = reached_eof;
+    }
+    else if (reached_eof && 0 == *count)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Reached EOF on %s.", source);
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+// Backs the io_uring event loop, whose reads land outside the process: appends
+// length bytes of data, then takes the complete messages like PB_receive_views.
+// At eof, a trailing line without newline is taken as well.
+PB_status_t PB_receive_feed(PB_process_t *process, bool is_err, const char *data, size_t length, bool eof, PB_message_view_t *views, size_t max_views, size_t *count)
+{
+    *count = 0;
+    PB_buffer_t *buffer = get_buffer(process, is_err);
+    if (NULL == buffer)
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    size_t space = 0;
+    if ((length > 0 && 0 != PB_buffer_append(buffer, data, length)) || (eof && NULL == PB_buffer_prepare(buffer, PB_buffer_length(buffer) + 1, &space)))
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    *count = take_messages(process, buffer, is_err, views, max_views, eof);
+    return PB_STATUS_OK;
 }
 
 //------------------------------------------------------------------------------
 
-static PB_status_t receive_dispatcher(PB_process_t *process, char *mailbox, size_t size, bool is_err)
+// A NULL length means a text call: the mailbox receives a NUL-terminated string.
+// A negative timeout waits forever.
+static PB_status_t receive_dispatcher(PB_process_t *process, void *mailbox, size_t size, size_t *length, bool is_err, int timeout_ms)
 {
     if (NULL == process)
     {
         return PB_STATUS_USAGE_ERROR;
     }
+    int64_t deadline = timeout_ms < 0 ? PB_NO_DEADLINE : PB_monotonic_ms() + timeout_ms;
     switch (process->type)
     {
     case PB_TYPE_PARENT:
-        return receive_from_parent(process, mailbox, size);
+        return receive_from_parent(process, mailbox, size, length, deadline);
         break;
     case PB_TYPE_CHILD:
-        return receive_from_child(process, mailbox, size, is_err);
+        return receive_from_child(process, mailbox, size, length, is_err, deadline);
         break;
     default:
         snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Not implemented");
@@ -47,142 +222,365 @@ static PB_status_t receive_dispatcher(PB_process_t *process, char *mailbox, size
     return PB_STATUS_USAGE_ERROR;
 }
 
-PB_status_t receive_from_parent(PB_process_t *process, char *mailbox, size_t size)
+static PB_status_t receive_from_parent(PB_process_t *process, void *mailbox, size_t size, size_t *length, int64_t deadline)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (NULL == mailbox || (0 == size && NULL == length))
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Mailbox argument is NULL or empty in receive_from_parent call");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    if (PB_FRAMING_LENGTH_PREFIXED == process->framing)
+    {
+        return receive_frame(process, mailbox, size, length, "stdin", deadline);
+    }
+    return receive_line(process, mailbox, size, false, "stdin", deadline);
+}
+
+static PB_status_t receive_from_child(PB_process_t *process, void *mailbox, size_t size, size_t *length, bool is_err, int64_t deadline)
 {
     if (NULL == process)
     {
         return PB_STATUS_USAGE_ERROR;
     }
 
-    if (NULL == mailbox)
+    if (NULL == mailbox || (0 == size && NULL == length))
     {
-        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Mailbox argument is NULL in receive_from_parent call");
+        strncpy(process->error, "Mailbox is NULL or empty in receive_from_child call", PB_STRING_SIZE_DEFAULT);
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    char *ptr = mailbox;
+    if (PB_FRAMING_LENGTH_PREFIXED == process->framing && !is_err)
+    {
+        return receive_frame(process, mailbox, size, length, "child's stdout", deadline);
+    }
+    if (is_err && NULL != process->stderr_drain)
+    {
+        PB_status_t status = PB_drain_take(process->stderr_drain, (char *)mailbox, size, deadline);
+        if (PB_STATUS_TERMINATED == status)
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Reached EOF on child's stderr.");
+            process->status = PB_STATUS_GENERIC_ERROR;
+            return PB_STATUS_GENERIC_ERROR;
+        }
+        if (PB_STATUS_TIMEOUT == status)
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Timed out while reading from child's stderr.");
+            process->status = PB_STATUS_TIMEOUT;
+        }
+        return status;
+    }
+    return receive_line(process, mailbox, size, is_err, is_err ? "child's stderr" : "child's stdout", deadline);
+}
+
+static PB_status_t receive_line(PB_process_t *process, char *mailbox, size_t size, bool is_err, const char *source, int64_t deadline)
+{
+    PB_buffer_t *buffer = get_buffer(process, is_err);
+    if (NULL == buffer)
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    size_t min_capacity = size > PB_BUFFER_SIZE_DEFAULT ? size : PB_BUFFER_SIZE_DEFAULT;
+    bool eof = false;
+    while (!PB_buffer_take_line(buffer, mailbox, size, eof))
+    {
+        if (eof)
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Reached EOF on %s.", source);
+            process->status = PB_STATUS_GENERIC_ERROR;
+            return PB_STATUS_GENERIC_ERROR;
+        }
+
+        PB_status_t status = fill_buffer(process, buffer, is_err, min_capacity, source, deadline, &eof);
+        if (PB_STATUS_OK != status)
+        {
+            return status;
+        }
+    }
+
+    return PB_STATUS_OK;
+}
+
+// Reads the header, then exactly header.length bytes. Text calls (NULL length)
+// keep one byte of the mailbox for the terminating NUL.
+static PB_status_t receive_frame(PB_process_t *process, void *mailbox, size_t size, size_t *length, const char *source, int64_t deadline)
+{
+    PB_buffer_t *buffer = get_buffer(process, false);
+    if (NULL == buffer)
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    bool eof = false;
+    while (PB_buffer_length(buffer) < sizeof(PB_frame_header_t))
+    {
+        if (eof)
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Reached EOF on %s.", source);
+            process->status = PB_STATUS_GENERIC_ERROR;
+            return PB_STATUS_GENERIC_ERROR;
+        }
+
+        PB_status_t status = fill_buffer(process, buffer, false, PB_BUFFER_SIZE_DEFAULT, source, deadline, &eof);
+        if (PB_STATUS_OK != status)
+        {
+            return status;
+        }
+    }
+
+    PB_frame_header_t header;
+    memcpy(&header, PB_buffer_begin(buffer), sizeof(header));
 
-    if (NULL == fgets(mailbox, PB_STRING_SIZE_DEFAULT, stdin))
+    size_t capacity = NULL == length ? size - 1 : size;
+    if (header.length > capacity)
     {
-        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "fgets() had an error or reached EOF");
+        if (NULL != length)
+        {
+            *length = header.length;
+        }
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Frame of %lu bytes does not fit in the mailbox", (unsigned long)header.length);
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    PB_strip_newlines(mailbox);
+    size_t total = sizeof(header) + header.length;
+    size_t min_capacity = total > PB_BUFFER_SIZE_DEFAULT ? total : PB_BUFFER_SIZE_DEFAULT;
+    while (PB_buffer_length(buffer) < total)
+    {
+        if (eof)
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Reached EOF in the middle of a frame on %s.", source);
+            process->status = PB_STATUS_GENERIC_ERROR;
+            return PB_STATUS_GENERIC_ERROR;
+        }
+
+        PB_status_t status = fill_buffer(process, buffer, false, min_capacity, source, deadline, &eof);
+        if (PB_STATUS_OK != status)
+        {
+            return status;
+        }
+    }
+
+    memcpy(mailbox, PB_buffer_begin(buffer) + sizeof(header), header.length);
+    PB_buffer_consume(buffer, total);
 
+    if (NULL != length)
+    {
+        *length = header.length;
+    }
+    else
+    {
+        ((char *)mailbox)[header.length] = '\0';
+    }
     return PB_STATUS_OK;
 }
 
-#ifdef _WIN32
+//------------------------------------------------------------------------------
 
-#include <windows.h>
-#include <io.h>
-#include <fcntl.h>
+static size_t take_messages(PB_process_t *process, PB_buffer_t *buffer, bool is_err, PB_message_view_t *views, size_t max_views, bool flush)
+{
+    if (PB_FRAMING_LENGTH_PREFIXED == process->framing && !is_err)
+    {
+        return PB_buffer_take_frames(buffer, views, max_views);
+    }
+    return PB_buffer_take_lines(buffer, views, max_views, flush);
+}
 
-static PB_status_t receive_from_child(PB_process_t *process, char mailbox[PB_STRING_SIZE_DEFAULT], size_t size, bool is_err)
+static PB_buffer_t *get_buffer(PB_process_t *process, bool is_err)
 {
-    if (NULL == process)
+    PB_buffer_t **buffer = is_err ? &process->receive_err_buffer : &process->receive_buffer;
+    if (NULL == *buffer)
     {
+        *buffer = PB_buffer_create(PB_BUFFER_SIZE_DEFAULT);
+        if (NULL == *buffer)
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+            process->status = PB_STATUS_GENERIC_ERROR;
+        }
+    }
+    return *buffer;
+}
+
+// Appends one read worth of data to the buffer, *eof is set when nothing came.
+// Pending bytes are never dropped, so a timeout leaves partial messages intact.
+static PB_status_t fill_buffer(PB_process_t *process, PB_buffer_t *buffer, bool is_err, size_t min_capacity, const char *source, int64_t deadline, bool *eof)
+{
+    // A read of our own would race the loop's pending one and could block.
+    if (process->loop_reads)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Cannot read from %s while an io_uring loop reads it.", source);
+        process->status = PB_STATUS_USAGE_ERROR;
         return PB_STATUS_USAGE_ERROR;
     }
 
-    if (NULL == mailbox)
+    size_t space = 0;
+    char *destination = PB_buffer_prepare(buffer, min_capacity, &space);
+    if (NULL == destination)
     {
-        strncpy(process->error, "Mailbox is NULL in receive_from_child call", PB_STRING_SIZE_DEFAULT);
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    char buf[2];
-    size_t index = 0;
+    int timeout_ms = -1;
+    if (PB_NO_DEADLINE != deadline)
+    {
+        int64_t remaining = deadline - PB_monotonic_ms();
+        timeout_ms = remaining > 0 ? (remaining < INT_MAX ? (int)remaining : INT_MAX) : 0;
+    }
+
+    // Coalesced sends go out before waiting: the answer may depend on them.
+    // A failed flush is left to the read, which sees the peer's EOF.
+    if (PB_FLUSH_COALESCE == process->flush_policy && NULL != process->send_buffer && PB_buffer_length(process->send_buffer) > 0)
+    {
+        PB_flush(process);
+    }
+
+    size_t bytes_read = 0;
+    PB_status_t status = read_some(process, is_err, destination, space, timeout_ms, &bytes_read);
+    if (PB_STATUS_TIMEOUT == status)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Timed out while reading from %s.", source);
+        process->status = PB_STATUS_TIMEOUT;
+        return PB_STATUS_TIMEOUT;
+    }
+    if (PB_STATUS_OK != status)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Error while reading from %s.", source);
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    PB_buffer_commit(buffer, bytes_read);
+    *eof = 0 == bytes_read;
+    return PB_STATUS_OK;
+}
 
+#ifdef _WIN32
+
+#include <windows.h>
+
+// Reads whatever is available (at least one byte), 0 bytes means EOF.
+// A non-negative timeout bounds the wait for the first byte.
+static PB_status_t read_some(PB_process_t *process, bool is_err, char *destination, size_t size, int timeout_ms, size_t *bytes_read)
+{
     HANDLE handle;
-    if (is_err)
+    if (PB_TYPE_PARENT == process->type)
     {
-        handle = process->stderr_h;
+        handle = GetStdHandle(STD_INPUT_HANDLE);
     }
     else
     {
-        handle = process->stdout_h;
+        handle = is_err ? process->stderr_h : process->stdout_h;
     }
 
-    while (true)
+    // Anonymous pipes have no overlapped I/O: poll them until the deadline.
+    if (timeout_ms >= 0)
     {
-        DWORD bytes_read;
-        BOOL result = ReadFile(handle, buf, 1, &bytes_read, NULL);
-        if (!result)
+        ULONGLONG deadline = GetTickCount64() + (ULONGLONG)timeout_ms;
+        while (true)
         {
-            DWORD error = GetLastError();
-            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Error while reading from child's %s.", is_err ? "stderr" : "stdout");
-            process->status = PB_STATUS_GENERIC_ERROR;
-            return PB_STATUS_GENERIC_ERROR;
-        }
-        else if (bytes_read != 0)
-        {
-            mailbox[index] = buf[0];
-            index++;
-            if (index >= size - 1 || buf[0] == '\n')
+            DWORD available = 0;
+            if (!PeekNamedPipe(handle, NULL, 0, NULL, &available, NULL) || available > 0)
+            {
+                break; // errors and EOF are reported by ReadFile below
+            }
+            if (GetTickCount64() >= deadline)
             {
-                mailbox[index] = '\0';
-                break;
+                return PB_STATUS_TIMEOUT;
             }
+            Sleep(1);
         }
     }
 
-    PB_strip_newlines(mailbox);
-
+    DWORD read = 0;
+    if (!ReadFile(handle, destination, (DWORD)size, &read, NULL))
+    {
+        if (ERROR_BROKEN_PIPE != GetLastError())
+        {
+            return PB_STATUS_GENERIC_ERROR;
+        }
+        read = 0;
+    }
+    *bytes_read = read;
     return PB_STATUS_OK;
 }
 
 #else // Unix
 
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "PB_shm.h"
 
-static PB_status_t receive_from_child(PB_process_t *process, char mailbox[PB_STRING_SIZE_DEFAULT], size_t size, bool is_err)
+// Reads whatever is available (at least one byte), 0 bytes means EOF.
+// A non-negative timeout bounds the wait for the first byte.
+static PB_status_t read_some(PB_process_t *process, bool is_err, char *destination, size_t size, int timeout_ms, size_t *bytes_read)
 {
-    if (NULL == process)
+    int fd;
+    if (PB_TYPE_PARENT == process->type)
     {
-        return PB_STATUS_USAGE_ERROR;
+        fd = STDIN_FILENO;
     }
-
-    if (NULL == mailbox)
+    else
     {
-        strncpy(process->error, "Mailbox is NULL in receive_from_child call", PB_STRING_SIZE_DEFAULT);
-        process->status = PB_STATUS_GENERIC_ERROR;
-        return PB_STATUS_GENERIC_ERROR;
+        fd = is_err ? process->stderr_fd : process->stdout_fd;
     }
 
-    char buf[2];
-    char index = 0;
-
-    int fd = is_err ? process->stderr_fd : process->stdout_fd;
+    if (NULL != process->shm && !is_err)
+    {
+        return PB_shm_read_some(process->shm, fd, destination, size, timeout_ms, bytes_read);
+    }
 
+    // Non-blocking fds need the poll() even without a timeout.
+    bool wait = timeout_ms >= 0;
     while (true)
     {
-        ssize_t bytes_read = read(fd, buf, 1);
-        if (-1 == bytes_read)
-        {
-            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Error while reading from child's %s.", is_err ? "stderr" : "stdout");
-            process->status = PB_STATUS_GENERIC_ERROR;
-            return PB_STATUS_GENERIC_ERROR;
-        }
-        else if (0 != bytes_read)
+        if (wait)
         {
-            mailbox[index] = buf[0];
-            index++;
-            if ('\n' == buf[0])
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            int ready;
+            do
+            {
+                ready = poll(&pfd, 1, timeout_ms);
+            } while (-1 == ready && EINTR == errno);
+
+            if (-1 == ready)
             {
-                mailbox[index] = 0;
-                break;
+                return PB_STATUS_GENERIC_ERROR;
+            }
+            if (0 == ready)
+            {
+                return PB_STATUS_TIMEOUT;
             }
         }
-    }
 
-    PB_strip_newlines(mailbox);
+        ssize_t result;
+        do
+        {
+            result = read(fd, destination, size);
+        } while (-1 == result && EINTR == errno);
 
-    return PB_STATUS_OK;
+        if (-1 == result && (EAGAIN == errno || EWOULDBLOCK == errno))
+        {
+            wait = true;
+            continue;
+        }
+        if (-1 == result)
+        {
+            return PB_STATUS_GENERIC_ERROR;
+        }
+        *bytes_read = (size_t)result;
+        return PB_STATUS_OK;
+    }
 }
 
 #endif
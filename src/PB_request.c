@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_internal.h"
+#include "process_bridge.h"
+
+#define PB_REQUESTS_CAPACITY_DEFAULT 64 // power of two
+#define PB_REQUESTS_VIEWS 64
+
+typedef struct
+{
+    uint64_t id; // 0 marks a free slot
+    PB_response_callback_t callback;
+    void *user_data;
+    char *message; // NULL unless the process retains requests, to replay them
+    size_t length;
+} request_slot_t;
+
+// Open addressing with linear probing, keyed by request id.
+struct PB_requests_t
+{
+    request_slot_t *slots;
+    size_t capacity;
+    size_t count;
+    uint64_t next_id;
+};
+
+static PB_status_t request_dispatcher(PB_process_t *process, const void *data, size_t length, PB_response_callback_t callback, void *user_data, uint64_t *id);
+static PB_requests_t *get_requests(PB_process_t *process);
+static request_slot_t *find_slot(PB_requests_t *requests, uint64_t id);
+static bool insert_slot(PB_requests_t *requests, const request_slot_t *slot);
+static void remove_slot(PB_requests_t *requests, request_slot_t *slot);
+static bool parse_envelope(PB_process_t *process, const char *data, size_t length, uint64_t *id, const char **payload, size_t *payload_length);
+
+//------------------------------------------------------------------------------
+
+PB_status_t PB_request(PB_process_t *process, const char *message, PB_response_callback_t callback, void *user_data, uint64_t *id)
+{
+    return request_dispatcher(process, message, NULL == message ? 0 : strlen(message), callback, user_data, id);
+}
+
+PB_status_t PB_request_bytes(PB_process_t *process, const void *data, size_t length, PB_response_callback_t callback, void *user_data, uint64_t *id)
+{
+    return request_dispatcher(process, data, length, callback, user_data, id);
+}
+
+PB_status_t PB_poll_responses(PB_process_t *process, int timeout_ms)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    PB_message_view_t views[PB_REQUESTS_VIEWS];
+    size_t count = 0;
+    bool eof = false;
+    do
+    {
+        PB_status_t status = PB_receive_views(process, false, views, PB_REQUESTS_VIEWS, &count, timeout_ms, &eof);
+        if (PB_STATUS_OK != status)
+        {
+            return status;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            PB_handle_response(process, views[i].data, views[i].length);
+        }
+        timeout_ms = 0; // only what is already there from now on
+    } while (count == PB_REQUESTS_VIEWS && !eof);
+
+    if (eof)
+    {
+        PB_cancel_requests(process);
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Reached EOF on child's stdout.");
+        process->status = PB_STATUS_TERMINATED;
+        return PB_STATUS_TERMINATED;
+    }
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_handle_response(PB_process_t *process, const char *data, size_t length)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    uint64_t id = 0;
+    const char *payload = NULL;
+    size_t payload_length = 0;
+    if (!parse_envelope(process, data, length, &id, &payload, &payload_length))
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    request_slot_t *slot = NULL == process->requests ? NULL : find_slot(process->requests, id);
+    if (NULL == slot)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Response to unknown request %llu.", (unsigned long long)id);
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    // Out of the table before the callback, which may issue new requests.
+    request_slot_t request = *slot;
+    remove_slot(process->requests, slot);
+    request.callback(process, PB_STATUS_OK, payload, payload_length, request.user_data);
+    free(request.message);
+    return PB_STATUS_OK;
+}
+
+size_t PB_requests_in_flight(const PB_process_t *process)
+{
+    return NULL == process || NULL == process->requests ? 0 : process->requests->count;
+}
+
+void PB_cancel_requests(PB_process_t *process)
+{
+    if (NULL == process || NULL == process->requests)
+    {
+        return;
+    }
+
+    // Detached first: callbacks may issue new requests on a fresh table.
+    PB_requests_t *requests = process->requests;
+    process->requests = NULL;
+    for (size_t i = 0; i < requests->capacity; i++)
+    {
+        request_slot_t *slot = &requests->slots[i];
+        if (0 != slot->id)
+        {
+            slot->callback(process, PB_STATUS_TERMINATED, NULL, 0, slot->user_data);
+            free(slot->message);
+        }
+    }
+    free(requests->slots);
+    free(requests);
+}
+
+void PB_take_requests(PB_process_t *process, PB_take_request_t take, void *context)
+{
+    if (NULL == process || NULL == process->requests)
+    {
+        return;
+    }
+
+    // Same as PB_cancel_requests, handing the requests over instead.
+    PB_requests_t *requests = process->requests;
+    process->requests = NULL;
+    for (size_t i = 0; i < requests->capacity; i++)
+    {
+        request_slot_t *slot = &requests->slots[i];
+        if (0 != slot->id)
+        {
+            take(slot->message, slot->length, slot->callback, slot->user_data, context);
+            free(slot->message);
+        }
+    }
+    free(requests->slots);
+    free(requests);
+}
+
+PB_status_t PB_receive_tagged(PB_process_t *process, uint64_t *id, void *mailbox, size_t size, size_t *length)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (NULL == id || NULL == mailbox || NULL == length)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Id, mailbox or length argument is NULL in PB_receive_tagged call");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    PB_status_t status;
+    size_t received = 0;
+    if (PB_FRAMING_LENGTH_PREFIXED == process->framing)
+    {
+        status = PB_receive_bytes(process, mailbox, size, &received);
+    }
+    else
+    {
+        status = PB_receive(process, (char *)mailbox, size);
+        received = PB_STATUS_OK == status ? strlen((char *)mailbox) : 0;
+    }
+    if (PB_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    const char *payload = NULL;
+    if (!parse_envelope(process, (const char *)mailbox, received, id, &payload, length))
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    memmove(mailbox, payload, *length);
+    if (PB_FRAMING_LENGTH_PREFIXED != process->framing)
+    {
+        ((char *)mailbox)[*length] = '\0';
+    }
+    return PB_STATUS_OK;
+}
+
+//------------------------------------------------------------------------------
+
+static PB_status_t request_dispatcher(PB_process_t *process, const void *data, size_t length, PB_response_callback_t callback, void *user_data, uint64_t *id)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (NULL == data || NULL == callback)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message or callback argument is NULL in PB_request call");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_TYPE_CHILD != process->type)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Requests can only be sent to a child process.");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    // Only a handback needs the payload once it is sent.
+    PB_requests_t *requests = get_requests(process);
+    char *message = NULL;
+    if (process->retain_requests)
+    {
+        message = (char *)malloc(length + 1);
+        if (NULL != message)
+        {
+            memcpy(message, data, length); // binary safe, unlike PB_string_clone
+            message[length] = '\0';
+        }
+    }
+    if (NULL == requests || (process->retain_requests && NULL == message))
+    {
+        free(message);
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    request_slot_t slot = {requests->next_id++, callback, user_data, message, length};
+    if (0 == requests->next_id)
+    {
+        requests->next_id = 1; // 0 marks free slots
+    }
+    if (!insert_slot(requests, &slot))
+    {
+        free(message);
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    PB_status_t status = process->nonblocking
+                             ? PB_try_send_tagged(process, slot.id, data, length)
+                             : PB_send_tagged(process, slot.id, data, length);
+    if (PB_STATUS_OK != status && PB_STATUS_WOULD_BLOCK != status)
+    {
+        remove_slot(requests, find_slot(requests, slot.id));
+        free(message);
+        return status;
+    }
+
+    if (NULL != id)
+    {
+        *id = slot.id;
+    }
+    return PB_STATUS_OK;
+}
+
+static PB_requests_t *get_requests(PB_process_t *process)
+{
+    if (NULL == process->requests)
+    {
+        PB_requests_t *requests = (PB_requests_t *)malloc(sizeof(PB_requests_t));
+        request_slot_t *slots = (request_slot_t *)calloc(PB_REQUESTS_CAPACITY_DEFAULT, sizeof(request_slot_t));
+        if (NULL == requests || NULL == slots)
+        {
+            free(requests);
+            free(slots);
+            return NULL;
+        }
+        requests->slots = slots;
+        requests->capacity = PB_REQUESTS_CAPACITY_DEFAULT;
+        requests->count = 0;
+        requests->next_id = 1;
+        process->requests = requests;
+    }
+    return process->requests;
+}
+
+static request_slot_t *find_slot(PB_requests_t *requests, uint64_t id)
+{
+    size_t mask = requests->capacity - 1;
+    for (size_t i = (size_t)id & mask;; i = (i + 1) & mask)
+    {
+        request_slot_t *slot = &requests->slots[i];
+        if (id == slot->id)
+        {
+            return slot;
+        }
+        if (0 == slot->id)
+        {
+            return NULL;
+        }
+    }
+}
+
+// Keeps the load factor under 1/2, doubling the table when needed.
+static bool insert_slot(PB_requests_t *requests, const request_slot_t *slot)
+{
+    if (2 * (requests->count + 1) > requests->capacity)
+    {
+        size_t capacity = 2 * requests->capacity;
+        request_slot_t *slots = (request_slot_t *)calloc(capacity, sizeof(request_slot_t));
+        if (NULL == slots)
+        {
+            return false;
+        }
+        request_slot_t *old_slots = requests->slots;
+        size_t old_capacity = requests->capacity;
+        requests->slots = slots;
+        requests->capacity = capacity;
+        requests->count = 0;
+        for (size_t i = 0; i < old_capacity; i++)
+        {
+            if (0 != old_slots[i].id)
+            {
+                insert_slot(requests, &old_slots[i]);
+            }
+        }
+        free(old_slots);
+    }
+
+    size_t mask = requests->capacity - 1;
+    size_t i = (size_t)slot->id & mask;
+    while (0 != requests->slots[i].id)
+    {
+        i = (i + 1) & mask;
+    }
+    requests->slots[i] = *slot;
+    requests->count++;
+    return true;
+}
+
+// Backward shift deletion: no tombstones, lookups stay short.
+static void remove_slot(PB_requests_t *requests, request_slot_t *slot)
+{
+    size_t mask = requests->capacity - 1;
+    size_t hole = (size_t)(slot - requests->slots);
+    for (size_t i = (hole + 1) & mask; 0 != requests->slots[i].id; i = (i + 1) & mask)
+    {
+        size_t home = (size_t)requests->slots[i].id & mask;
+        // Move back the entries whose home is not between the hole and them.
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            requests->slots[hole] = requests->slots[i];
+            hole = i;
+        }
+    }
+    memset(&requests->slots[hole], 0, sizeof(request_slot_t));
+    requests->count--;
+}
+
+static bool parse_envelope(PB_process_t *process, const char *data, size_t length, uint64_t *id, const char **payload, size_t *payload_length)
+{
+    if (PB_FRAMING_LENGTH_PREFIXED == process->framing)
+    {
+        if (length >= sizeof(uint64_t))
+        {
+            memcpy(id, data, sizeof(uint64_t));
+            *payload = data + sizeof(uint64_t);
+            *payload_length = length - sizeof(uint64_t);
+            return true;
+        }
+    }
+    else
+    {
+        uint64_t value = 0;
+        size_t i = 0;
+        while (i < length && i < 20 && data[i] >= '0' && data[i] <= '9')
+        {
+            value = 10 * value + (uint64_t)(data[i] - '0');
+            i++;
+        }
+        if (i > 0 && i < length && '\t' == data[i])
+        {
+            *id = value;
+            *payload = data + i + 1;
+            *payload_length = length - i - 1;
+            return true;
+        }
+    }
+
+    snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message without a request id.");
+    process->status = PB_STATUS_GENERIC_ERROR;
+    return false;
+}
@@ -1,44 +1,140 @@
+#ifdef __linux__
+#define _GNU_SOURCE // splice, vmsplice
+#endif
+
 #include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
 
 #include "PB_generic_functions.h"
+#include "PB_internal.h"
 #include "process_bridge.h"
 
 //------------------------------------------------------------------------------
 
-static PB_status_t send_dispatcher(PB_process_t *process, const char *message, bool is_err);
+static PB_status_t send_dispatcher(PB_process_t *process, const uint64_t *id, const void *data, size_t length, bool is_err, bool try_only);
+
+static PB_status_t send_to_parent(PB_process_t *process, const uint64_t *id, const void *data, size_t length, bool is_err);
+static PB_status_t send_to_child(PB_process_t *process, const uint64_t *id, const void *data, size_t length, bool try_only);
+
+static PB_status_t send_batch(PB_process_t *process, const void *const *data, const size_t *lengths, size_t count);
+static PB_status_t write_batch(PB_process_t *process, const void *const *data, const size_t *lengths, size_t count);
+
+// Room for the text envelope "<id>\t" or the binary id of a tagged message.
+#define PB_TAG_SIZE 24
 
-static PB_status_t send_to_parent(PB_process_t *process, const char *message, bool is_err);
-static PB_status_t send_to_child(PB_process_t *process, const char *message);
+static size_t wire_parts(PB_process_t *process, bool is_err, const uint64_t *id, const void *data, size_t length,
+                         PB_frame_header_t *header, char *tag, const void *bases[3], size_t lengths[3]);
 
 //------------------------------------------------------------------------------
 
 PB_status_t PB_send(PB_process_t *process, const char *message)
 {
-    return send_dispatcher(process, message, false);
+    return send_dispatcher(process, NULL, message, message ? strlen(message) : 0, false, false);
 }
 
 PB_status_t PB_send_err(PB_process_t *process, const char *message)
 {
-    return send_dispatcher(process, message, true);
+    return send_dispatcher(process, NULL, message, message ? strlen(message) : 0, true, false);
+}
+
+PB_status_t PB_send_bytes(PB_process_t *process, const void *data, size_t length)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_FRAMING_LENGTH_PREFIXED != process->framing)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "PB_send_bytes needs a process created with PB_FRAMING_LENGTH_PREFIXED");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    return send_dispatcher(process, NULL, data, length, false, false);
+}
+
+PB_status_t PB_try_send(PB_process_t *process, const char *message)
+{
+    return send_dispatcher(process, NULL, message, message ? strlen(message) : 0, false, true);
+}
+
+PB_status_t PB_try_send_bytes(PB_process_t *process, const void *data, size_t length)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_FRAMING_LENGTH_PREFIXED != process->framing)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "PB_try_send_bytes needs a process created with PB_FRAMING_LENGTH_PREFIXED");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    return send_dispatcher(process, NULL, data, length, false, true);
+}
+
+// Any framing, for the async API.
+PB_status_t PB_try_send_message(PB_process_t *process, const void *data, size_t length)
+{
+    return send_dispatcher(process, NULL, data, length, false, true);
+}
+
+PB_status_t PB_send_batch(PB_process_t *process, const char **messages, size_t count)
+{
+    return send_batch(process, (const void *const *)messages, NULL, count);
+}
+
+PB_status_t PB_send_bytes_batch(PB_process_t *process, const void *const *data, const size_t *lengths, size_t count)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (PB_FRAMING_LENGTH_PREFIXED != process->framing || NULL == lengths)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "PB_send_bytes_batch needs a framed process and a lengths array");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    return send_batch(process, data, lengths, count);
 }
 
 //------------------------------------------------------------------------------
 
-static PB_status_t send_dispatcher(PB_process_t *process, const char *message, bool is_err)
+static PB_status_t send_dispatcher(PB_process_t *process, const uint64_t *id, const void *data, size_t length, bool is_err, bool try_only)
 {
     if (NULL == process)
     {
         return PB_STATUS_USAGE_ERROR;
     }
+
+    if (try_only && (PB_TYPE_CHILD != process->type || !process->nonblocking))
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Try sends need a child process in non-blocking mode");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    size_t framed_length = NULL == id ? length : length + sizeof(uint64_t);
+    if ((framed_length < length || framed_length > PB_FRAME_LENGTH_MAX) && PB_FRAMING_LENGTH_PREFIXED == process->framing && !is_err)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message of %zu bytes exceeds the frame length limit", length);
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
     switch (process->type)
     {
     case PB_TYPE_PARENT:
-        return send_to_parent(process, message, is_err);
+        return send_to_parent(process, id, data, length, is_err);
         break;
     case PB_TYPE_CHILD:
-        return send_to_child(process, message);
+        return send_to_child(process, id, data, length, try_only);
         break;
     default:
         snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Not implemented");
@@ -49,54 +145,94 @@ static PB_status_t send_dispatcher(PB_process_t *process, const char *message, b
     return PB_STATUS_USAGE_ERROR;
 }
 
-//------------------------------------------------------------------------------
-
-static PB_status_t send_to_parent(PB_process_t *process, const char *message, bool is_err)
+// A NULL lengths array means the messages are NUL-terminated strings.
+static PB_status_t send_batch(PB_process_t *process, const void *const *data, const size_t *lengths, size_t count)
 {
     if (NULL == process)
     {
         return PB_STATUS_USAGE_ERROR;
     }
 
-    if (NULL == message)
+    if (PB_TYPE_PARENT != process->type && PB_TYPE_CHILD != process->type)
     {
-        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message argument is NULL in send_to_parent call");
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Not implemented");
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    char *output = PB_string_clone_with_newline(message, strlen(message));
+    if (NULL == data && count > 0)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Messages argument is NULL in send_batch call");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
 
-    if (is_err)
+    for (size_t i = 0; i < count; i++)
     {
-        if (fputs(output, stderr) < 0)
+        if (NULL == data[i])
         {
-            if (output)
-                free(output);
-            strncpy(process->error, "Could not print to stderr", PB_STRING_SIZE_DEFAULT);
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message %zu is NULL in send_batch call", i);
             process->status = PB_STATUS_GENERIC_ERROR;
             return PB_STATUS_GENERIC_ERROR;
         }
+        if (NULL != lengths && lengths[i] > PB_FRAME_LENGTH_MAX)
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message %zu exceeds the frame length limit", i);
+            process->status = PB_STATUS_USAGE_ERROR;
+            return PB_STATUS_USAGE_ERROR;
+        }
+    }
+
+    return write_batch(process, data, lengths, count);
+}
+
+// Splits a message in the pieces that go on the wire: header and payload on
+// framed channels, payload and newline on text ones. stderr is always text.
+// A tagged message (non-NULL id) carries its id between header and payload,
+// or as a "<id>\t" prefix on text channels.
+static size_t wire_parts(PB_process_t *process, bool is_err, const uint64_t *id, const void *data, size_t length,
+                         PB_frame_header_t *header, char *tag, const void *bases[3], size_t lengths[3])
+{
+    size_t count = 0;
+    if (PB_FRAMING_LENGTH_PREFIXED == process->framing && !is_err)
+    {
+        header->length = (uint32_t)(NULL == id ? length : length + sizeof(uint64_t));
+        header->flags = NULL == id ? 0 : PB_FRAME_FLAG_TAGGED;
+        bases[count] = header;
+        lengths[count++] = sizeof(PB_frame_header_t);
+        if (NULL != id)
+        {
+            memcpy(tag, id, sizeof(uint64_t));
+            bases[count] = tag;
+            lengths[count++] = sizeof(uint64_t);
+        }
+        bases[count] = data;
+        lengths[count++] = length;
     }
     else
     {
-        if (fputs(output, stdout) < 0)
+        if (NULL != id)
         {
-            if (output)
-                free(output);
-            strncpy(process->error, "Could not print to stdout", PB_STRING_SIZE_DEFAULT);
-            process->status = PB_STATUS_GENERIC_ERROR;
-            return PB_STATUS_GENERIC_ERROR;
+            bases[count] = tag;
+            lengths[count++] = (size_t)snprintf(tag, PB_TAG_SIZE, "%llu\t", (unsigned long long)*id);
         }
+        bases[count] = data;
+        lengths[count++] = length;
+        bases[count] = NEWLINE;
+        lengths[count++] = NEWLINE_LEN;
     }
+    return count;
+}
 
-    if (output)
-        free(output);
-
-    return PB_STATUS_OK;
+PB_status_t PB_send_tagged(PB_process_t *process, uint64_t id, const void *data, size_t length)
+{
+    return send_dispatcher(process, &id, data, length, false, false);
 }
 
-//------------------------------------------------------------------------------
+PB_status_t PB_try_send_tagged(PB_process_t *process, uint64_t id, const void *data, size_t length)
+{
+    return send_dispatcher(process, &id, data, length, false, true);
+}
 
 #ifdef _WIN32
 
@@ -104,89 +240,732 @@ static PB_status_t send_to_parent(PB_process_t *process, const char *message, bo
 #include <io.h>
 #include <fcntl.h>
 
-static PB_status_t send_to_child(PB_process_t *process, const char *message)
+static PB_status_t send_to_parent(PB_process_t *process, const uint64_t *id, const void *data, size_t length, bool is_err)
 {
     if (NULL == process)
     {
         return PB_STATUS_USAGE_ERROR;
     }
 
-    if (NULL == message)
+    if (NULL == data)
     {
-        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message argument is NULL in send_to_child call");
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message argument is NULL in send_to_parent call");
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    char *msg_copy = PB_string_clone_with_newline(message, strlen(message));
-    if (msg_copy == NULL)
+    PB_frame_header_t header;
+    char tag[PB_TAG_SIZE];
+    const void *bases[3];
+    size_t lengths[3];
+    size_t count = wire_parts(process, is_err, id, data, length, &header, tag, bases, lengths);
+
+    FILE *stream = is_err ? stderr : stdout;
+    bool failed = false;
+    for (size_t i = 0; i < count && !failed; i++)
     {
-        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Memory allocation error");
+        failed = fwrite(bases[i], 1, lengths[i], stream) != lengths[i];
+    }
+    if (failed)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Could not print to %s", is_err ? "stderr" : "stdout");
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    DWORD bytes_written = 0;
-    if (!WriteFile(process->stdin_h, msg_copy, (DWORD)strlen(msg_copy), &bytes_written, NULL))
+    return PB_STATUS_OK;
+}
+
+static PB_status_t send_to_child(PB_process_t *process, const uint64_t *id, const void *data, size_t length, bool try_only)
+{
+    if (NULL == process)
     {
-        free(msg_copy);
-        strncpy(process->error, "Couldn't write to child's stdin", PB_STRING_SIZE_DEFAULT);
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (NULL == data)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message argument is NULL in send_to_child call");
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    if (!FlushFileBuffers(process->stdin_h))
+    (void)try_only; // PB_set_nonblocking is refused on Windows
+
+    PB_frame_header_t header;
+    char tag[PB_TAG_SIZE];
+    const void *bases[3];
+    size_t lengths[3];
+    size_t count = wire_parts(process, false, id, data, length, &header, tag, bases, lengths);
+
+    bool failed = false;
+    for (size_t i = 0; i < count && !failed; i++)
+    {
+        DWORD bytes_written = 0;
+        failed = !WriteFile(process->stdin_h, bases[i], (DWORD)lengths[i], &bytes_written, NULL);
+    }
+    if (failed)
     {
-        free(msg_copy);
-        strncpy(process->error, "Couldn't flush child's stdin", PB_STRING_SIZE_DEFAULT);
+        strncpy(process->error, "Couldn't write to child's stdin", PB_STRING_SIZE_DEFAULT);
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    free(msg_copy);
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_flush(PB_process_t *process)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+void PB_flush_without_blocking(PB_process_t *process)
+{
+    (void)process;
+}
+
+PB_status_t PB_send_file(PB_process_t *process, int fd, int64_t offset, size_t length)
+{
+    (void)fd;
+    (void)offset;
+    (void)length;
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+    snprintf(process->error, PB_STRING_SIZE_DEFAULT, "PB_send_file is not supported on Windows.");
+    process->status = PB_STATUS_USAGE_ERROR;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_send_pages(PB_process_t *process, const void *data, size_t length)
+{
+    (void)data;
+    (void)length;
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+    snprintf(process->error, PB_STRING_SIZE_DEFAULT, "PB_send_pages is not supported on Windows.");
+    process->status = PB_STATUS_USAGE_ERROR;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+static PB_status_t write_batch(PB_process_t *process, const void *const *data, const size_t *lengths, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t length = NULL == lengths ? strlen((const char *)data[i]) : lengths[i];
+        PB_status_t status = PB_TYPE_PARENT == process->type
+                                 ? send_to_parent(process, NULL, data[i], length, false)
+                                 : send_to_child(process, NULL, data[i], length, false);
+        if (PB_STATUS_OK != status)
+        {
+            return status;
+        }
+    }
     return PB_STATUS_OK;
 }
 
 #else // Unix
 
 #include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "PB_buffer.h"
+#include "PB_shm.h"
+
+#ifdef IOV_MAX
+#define PB_IOV_MAX IOV_MAX
+#else
+#define PB_IOV_MAX 1024
+#endif
 
-static PB_status_t send_to_child(PB_process_t *process, const char *message)
+// Messages gathered in one writev(): each one takes two iovecs.
+#define PB_BATCH_CHUNK (PB_IOV_MAX / 2)
+
+static PB_status_t begin_raw(PB_process_t *process, int fd, size_t length, const char *caller);
+static int splice_all(PB_process_t *process, int fd, int in_fd, int64_t offset, size_t length);
+static int vmsplice_all(PB_process_t *process, int fd, const void *data, size_t length);
+static int copy_file(PB_process_t *process, int fd, int in_fd, int64_t offset, size_t length);
+static PB_status_t output(PB_process_t *process, int fd, struct iovec *iov, int iovcnt, bool try_only);
+static PB_status_t drain_queue(PB_process_t *process, int fd, bool try_only);
+static int enqueue(PB_process_t *process, const struct iovec *iov, int iovcnt);
+static PB_shm_t *ring_for(PB_process_t *process, int fd);
+static ssize_t transport_writev(PB_process_t *process, int fd, const struct iovec *iov, int iovcnt);
+static int write_all(PB_process_t *process, int fd, struct iovec *iov, int iovcnt);
+static int wait_writable(PB_process_t *process, int fd);
+static int skip_written(struct iovec **iov, int *iovcnt, size_t written);
+
+static PB_status_t send_to_parent(PB_process_t *process, const uint64_t *id, const void *data, size_t length, bool is_err)
 {
     if (NULL == process)
     {
         return PB_STATUS_USAGE_ERROR;
     }
 
-    if (NULL == message)
+    if (NULL == data)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message argument is NULL in send_to_parent call");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    PB_frame_header_t header;
+    char tag[PB_TAG_SIZE];
+    const void *bases[3];
+    size_t lengths[3];
+    size_t count = wire_parts(process, is_err, id, data, length, &header, tag, bases, lengths);
+
+    struct iovec iov[3];
+    for (size_t i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *)bases[i];
+        iov[i].iov_len = lengths[i];
+    }
+
+    bool failed = is_err ? 0 != write_all(process, STDERR_FILENO, iov, (int)count)
+                         : PB_STATUS_OK != output(process, STDOUT_FILENO, iov, (int)count, false);
+    if (failed)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Could not print to %s", is_err ? "stderr" : "stdout");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    return PB_STATUS_OK;
+}
+
+static PB_status_t send_to_child(PB_process_t *process, const uint64_t *id, const void *data, size_t length, bool try_only)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (NULL == data)
     {
         snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Message argument is NULL in send_to_child call");
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    char *msg_copy = strdup(message);
-    strcat(msg_copy, NEWLINE);
+    PB_frame_header_t header;
+    char tag[PB_TAG_SIZE];
+    const void *bases[3];
+    size_t lengths[3];
+    size_t count = wire_parts(process, false, id, data, length, &header, tag, bases, lengths);
 
-    ssize_t bytes_written = write(process->stdin_fd, msg_copy, strlen(msg_copy));
-    if (bytes_written == -1)
+    struct iovec iov[3];
+    for (size_t i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *)bases[i];
+        iov[i].iov_len = lengths[i];
+    }
+
+    PB_status_t status = output(process, process->stdin_fd, iov, (int)count, try_only);
+    if (PB_STATUS_GENERIC_ERROR == status)
     {
-        free(msg_copy);
         strncpy(process->error, "Couldn't write to child's stdin", PB_STRING_SIZE_DEFAULT);
         process->status = PB_STATUS_GENERIC_ERROR;
+    }
+
+    return status;
+}
+
+static PB_status_t write_batch(PB_process_t *process, const void *const *data, const size_t *lengths, size_t count)
+{
+    int fd = PB_TYPE_PARENT == process->type ? STDOUT_FILENO : process->stdin_fd;
+
+    struct iovec iov[PB_BATCH_CHUNK * 2];
+    PB_frame_header_t headers[PB_BATCH_CHUNK];
+
+    for (size_t first = 0; first < count; first += PB_BATCH_CHUNK)
+    {
+        size_t chunk = count - first < PB_BATCH_CHUNK ? count - first : PB_BATCH_CHUNK;
+        int iovcnt = 0;
+        for (size_t i = 0; i < chunk; i++)
+        {
+            const void *message = data[first + i];
+            size_t length = NULL == lengths ? strlen((const char *)message) : lengths[first + i];
+
+            const void *bases[3];
+            size_t parts_lengths[3];
+            size_t parts = wire_parts(process, false, NULL, message, length, &headers[i], NULL, bases, parts_lengths);
+            for (size_t j = 0; j < parts; j++)
+            {
+                iov[iovcnt].iov_base = (void *)bases[j];
+                iov[iovcnt].iov_len = parts_lengths[j];
+                iovcnt++;
+            }
+        }
+
+        if (PB_STATUS_OK != output(process, fd, iov, iovcnt, false))
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Couldn't write batch to %s", PB_TYPE_PARENT == process->type ? "stdout" : "child's stdin");
+            process->status = PB_STATUS_GENERIC_ERROR;
+            return PB_STATUS_GENERIC_ERROR;
+        }
+    }
+
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_flush(PB_process_t *process)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    int fd = PB_TYPE_PARENT == process->type ? STDOUT_FILENO : process->stdin_fd;
+    PB_status_t status = drain_queue(process, fd, process->nonblocking);
+    if (PB_STATUS_GENERIC_ERROR == status)
+    {
+        strncpy(process->error, "Couldn't flush queued messages", PB_STRING_SIZE_DEFAULT);
+        process->status = PB_STATUS_GENERIC_ERROR;
+    }
+    return status;
+}
+
+void PB_flush_without_blocking(PB_process_t *process)
+{
+    int fd = PB_TYPE_PARENT == process->type ? STDOUT_FILENO : process->stdin_fd;
+    PB_buffer_t *queue = process->send_buffer;
+    if (-1 == fd || NULL == queue || 0 == PB_buffer_length(queue))
+    {
+        return;
+    }
+
+    // A reader that is gone must not raise SIGPIPE: it stays blocked here and
+    // is consumed below, unless it was already pending for someone else.
+    sigset_t sigpipe;
+    sigset_t previous;
+    sigset_t pending;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, &previous);
+    sigpending(&pending);
+    bool was_pending = 1 == sigismember(&pending, SIGPIPE);
+
+    while (PB_buffer_length(queue) > 0)
+    {
+        size_t chunk = PB_buffer_length(queue);
+        if (NULL == ring_for(process, fd) && !process->nonblocking)
+        {
+            // Once poll() reports room, a blocking pipe takes PIPE_BUF bytes at once.
+            struct pollfd pfd = {.fd = fd, .events = POLLOUT, .revents = 0};
+            if (1 != poll(&pfd, 1, 0) || POLLOUT != (pfd.revents & (POLLOUT | POLLERR)))
+            {
+                break;
+            }
+            chunk = chunk < PIPE_BUF ? chunk : PIPE_BUF;
+        }
+        struct iovec iov = {.iov_base = (void *)PB_buffer_begin(queue), .iov_len = chunk};
+        ssize_t written = transport_writev(process, fd, &iov, 1);
+        if (-1 == written && EINTR != errno)
+        {
+            break;
+        }
+        if (written > 0)
+        {
+            PB_buffer_consume(queue, (size_t)written);
+        }
+    }
+
+    if (!was_pending)
+    {
+        struct timespec now = {.tv_sec = 0, .tv_nsec = 0};
+        sigtimedwait(&sigpipe, NULL, &now);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+PB_status_t PB_send_file(PB_process_t *process, int fd, int64_t offset, size_t length)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    int out_fd = PB_TYPE_PARENT == process->type ? STDOUT_FILENO : process->stdin_fd;
+    PB_status_t status = begin_raw(process, out_fd, length, "PB_send_file");
+    if (PB_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    if (splice_all(process, out_fd, fd, offset, length))
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Couldn't send %zu bytes of the file to %s", length,
+                 PB_TYPE_PARENT == process->type ? "stdout" : "child's stdin");
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_send_pages(PB_process_t *process, const void *data, size_t length)
+{
+    if (NULL == process)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (NULL == data || (page_size > 0 && 0 != (uintptr_t)data % (uintptr_t)page_size))
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "PB_send_pages needs a page-aligned buffer");
+        process->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    int out_fd = PB_TYPE_PARENT == process->type ? STDOUT_FILENO : process->stdin_fd;
+    PB_status_t status = begin_raw(process, out_fd, length, "PB_send_pages");
+    if (PB_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    if (vmsplice_all(process, out_fd, data, length))
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Couldn't send pages to %s", PB_TYPE_PARENT == process->type ? "stdout" : "child's stdin");
+        process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
+    return PB_STATUS_OK;
+}
 
-    if (fsync(process->stdin_fd))
+// Everything queued, and the header on framed channels, goes out before the raw bytes.
+static PB_status_t begin_raw(PB_process_t *process, int fd, size_t length, const char *caller)
+{
+    if (PB_TYPE_PARENT != process->type && PB_TYPE_CHILD != process->type)
     {
-        free(msg_copy);
-        strncpy(process->error, "Couldn't fsync child's stdin", PB_STRING_SIZE_DEFAULT);
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "Not implemented");
         process->status = PB_STATUS_GENERIC_ERROR;
         return PB_STATUS_GENERIC_ERROR;
     }
 
-    free(msg_copy);
+    // The header joins the queue, even when coalescing would keep it there:
+    // draining writes it out, behind what came before, ahead of the raw bytes.
+    PB_status_t status = PB_STATUS_OK;
+    if (PB_FRAMING_LENGTH_PREFIXED == process->framing)
+    {
+        if (length > PB_FRAME_LENGTH_MAX)
+        {
+            snprintf(process->error, PB_STRING_SIZE_DEFAULT, "%s: %zu bytes do not fit in one frame", caller, length);
+            process->status = PB_STATUS_USAGE_ERROR;
+            return PB_STATUS_USAGE_ERROR;
+        }
+        PB_frame_header_t header = {(uint32_t)length, 0};
+        struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+        status = enqueue(process, &iov, 1) ? PB_STATUS_GENERIC_ERROR : PB_STATUS_OK;
+    }
+    if (PB_STATUS_OK == status)
+    {
+        status = drain_queue(process, fd, false);
+    }
+
+    if (PB_STATUS_OK != status)
+    {
+        snprintf(process->error, PB_STRING_SIZE_DEFAULT, "%s: couldn't write what was queued before", caller);
+        process->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    return PB_STATUS_OK;
+}
+
+// File pages go straight into the pipe; rings, non-pipe outputs and other
+// systems fall back to copying.
+static int splice_all(PB_process_t *process, int fd, int in_fd, int64_t offset, size_t length)
+{
+#ifdef __linux__
+    if (NULL != ring_for(process, fd))
+    {
+        return copy_file(process, fd, in_fd, offset, length);
+    }
+
+    loff_t position = (loff_t)offset;
+    bool moved_any = false;
+    while (length > 0)
+    {
+        ssize_t moved = splice(in_fd, offset < 0 ? NULL : &position, fd, NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (-1 == moved)
+        {
+            if (EINTR == errno || ((EAGAIN == errno || EWOULDBLOCK == errno) && 0 == wait_writable(process, fd)))
+            {
+                continue;
+            }
+            if (!moved_any && EINVAL == errno)
+            {
+                return copy_file(process, fd, in_fd, offset, length);
+            }
+            return 1;
+        }
+        if (0 == moved)
+        {
+            return 1; // the file is shorter than length
+        }
+        moved_any = true;
+        length -= (size_t)moved;
+    }
+    return 0;
+#else
+    return copy_file(process, fd, in_fd, offset, length);
+#endif
+}
+
+static int vmsplice_all(PB_process_t *process, int fd, const void *data, size_t length)
+{
+    struct iovec iov = {.iov_base = (void *)data, .iov_len = length};
+#ifdef __linux__
+    if (NULL != ring_for(process, fd))
+    {
+        return write_all(process, fd, &iov, 1);
+    }
+
+    bool moved_any = false;
+    while (iov.iov_len > 0)
+    {
+        ssize_t moved = vmsplice(fd, &iov, 1, 0);
+        if (-1 == moved)
+        {
+            if (EINTR == errno || ((EAGAIN == errno || EWOULDBLOCK == errno) && 0 == wait_writable(process, fd)))
+            {
+                continue;
+            }
+            if (!moved_any && (EINVAL == errno || EBADF == errno))
+            {
+                return write_all(process, fd, &iov, 1); // not a pipe
+            }
+            return 1;
+        }
+        moved_any = true;
+        iov.iov_base = (char *)iov.iov_base + moved;
+        iov.iov_len -= (size_t)moved;
+    }
+    return 0;
+#else
+    return write_all(process, fd, &iov, 1);
+#endif
+}
+
+static int copy_file(PB_process_t *process, int fd, int in_fd, int64_t offset, size_t length)
+{
+    char *chunk = (char *)malloc(PB_BUFFER_SIZE_DEFAULT);
+    if (NULL == chunk)
+    {
+        return 1;
+    }
+
+    int failed = 0;
+    while (length > 0 && !failed)
+    {
+        size_t wanted = length < PB_BUFFER_SIZE_DEFAULT ? length : PB_BUFFER_SIZE_DEFAULT;
+        ssize_t got = offset < 0 ? read(in_fd, chunk, wanted) : pread(in_fd, chunk, wanted, (off_t)offset);
+        if (-1 == got && EINTR == errno)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            failed = 1;
+            break;
+        }
+        struct iovec iov = {.iov_base = chunk, .iov_len = (size_t)got};
+        failed = write_all(process, fd, &iov, 1);
+        length -= (size_t)got;
+        offset = offset < 0 ? offset : offset + got;
+    }
+    free(chunk);
+    return failed;
+}
+
+// Writes the iovecs to fd behind whatever is still queued for the process.
+// In try mode nothing blocks: the part that cannot be written right away is
+// queued and PB_STATUS_WOULD_BLOCK is returned.
+static PB_status_t output(PB_process_t *process, int fd, struct iovec *iov, int iovcnt, bool try_only)
+{
+    // Coalescing: small messages only join the queue, a full queue goes out with this one.
+    if (PB_FLUSH_COALESCE == process->flush_policy)
+    {
+        size_t total = NULL == process->send_buffer ? 0 : PB_buffer_length(process->send_buffer);
+        for (int i = 0; i < iovcnt; i++)
+        {
+            total += iov[i].iov_len;
+        }
+        if (total < PB_COALESCE_SIZE)
+        {
+            return enqueue(process, iov, iovcnt) ? PB_STATUS_GENERIC_ERROR : PB_STATUS_OK;
+        }
+    }
+
+    PB_status_t status = drain_queue(process, fd, try_only);
+    if (PB_STATUS_GENERIC_ERROR == status)
+    {
+        return status;
+    }
+
+    if (PB_STATUS_OK == status && !try_only)
+    {
+        return write_all(process, fd, iov, iovcnt) ? PB_STATUS_GENERIC_ERROR : PB_STATUS_OK;
+    }
+
+    if (PB_STATUS_OK == status)
+    {
+        ssize_t written;
+        do
+        {
+            written = transport_writev(process, fd, iov, iovcnt);
+        } while (-1 == written && EINTR == errno);
+
+        if (-1 == written && EAGAIN != errno && EWOULDBLOCK != errno)
+        {
+            return PB_STATUS_GENERIC_ERROR;
+        }
+        if (0 == skip_written(&iov, &iovcnt, -1 == written ? 0 : (size_t)written))
+        {
+            return PB_STATUS_OK;
+        }
+    }
+
+    return enqueue(process, iov, iovcnt) ? PB_STATUS_GENERIC_ERROR : PB_STATUS_WOULD_BLOCK;
+}
+
+static int enqueue(PB_process_t *process, const struct iovec *iov, int iovcnt)
+{
+    if (NULL == process->send_buffer)
+    {
+        process->send_buffer = PB_buffer_create(PB_BUFFER_SIZE_DEFAULT);
+        if (NULL == process->send_buffer)
+        {
+            return 1;
+        }
+    }
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (PB_buffer_append(process->send_buffer, iov[i].iov_base, iov[i].iov_len))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Writes out the queued bytes; in try mode stops as soon as the pipe is full.
+static PB_status_t drain_queue(PB_process_t *process, int fd, bool try_only)
+{
+    PB_buffer_t *queue = process->send_buffer;
+    while (NULL != queue && PB_buffer_length(queue) > 0)
+    {
+        struct iovec iov = {.iov_base = (void *)PB_buffer_begin(queue), .iov_len = PB_buffer_length(queue)};
+        ssize_t written = transport_writev(process, fd, &iov, 1);
+        if (-1 == written)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (EAGAIN != errno && EWOULDBLOCK != errno)
+            {
+                return PB_STATUS_GENERIC_ERROR;
+            }
+            if (try_only)
+            {
+                return PB_STATUS_WOULD_BLOCK;
+            }
+            if (wait_writable(process, fd))
+            {
+                return PB_STATUS_GENERIC_ERROR;
+            }
+            continue;
+        }
+        PB_buffer_consume(queue, (size_t)written);
+    }
     return PB_STATUS_OK;
 }
 
+// stdin/stdout data go through the rings when the process has them.
+static PB_shm_t *ring_for(PB_process_t *process, int fd)
+{
+    int data_fd = PB_TYPE_PARENT == process->type ? STDOUT_FILENO : process->stdin_fd;
+    return data_fd == fd ? process->shm : NULL;
+}
+
+static ssize_t transport_writev(PB_process_t *process, int fd, const struct iovec *iov, int iovcnt)
+{
+    PB_shm_t *shm = ring_for(process, fd);
+    return NULL == shm ? writev(fd, iov, iovcnt) : PB_shm_writev(shm, iov, iovcnt);
+}
+
+// Writes every iovec, resuming after partial writes. The iovecs are modified.
+static int write_all(PB_process_t *process, int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t written = transport_writev(process, fd, iov, iovcnt);
+        if (-1 == written)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if ((EAGAIN == errno || EWOULDBLOCK == errno) && 0 == wait_writable(process, fd))
+            {
+                continue;
+            }
+            return 1;
+        }
+        skip_written(&iov, &iovcnt, (size_t)written);
+    }
+    return 0;
+}
+
+// Blocks until a non-blocking fd, or the ring in its place, accepts data again.
+static int wait_writable(PB_process_t *process, int fd)
+{
+    PB_shm_t *shm = ring_for(process, fd);
+    if (NULL != shm)
+    {
+        return PB_shm_wait_writable(shm, fd);
+    }
+
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    int ready;
+    do
+    {
+        ready = poll(&pfd, 1, -1);
+    } while (-1 == ready && EINTR == errno);
+    return -1 == ready ? 1 : 0;
+}
+
+// Advances the iovecs past written bytes, returns how many are left.
+static int skip_written(struct iovec **iov, int *iovcnt, size_t written)
+{
+    while (*iovcnt > 0 && written >= (*iov)->iov_len)
+    {
+        written -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+    if (*iovcnt > 0)
+    {
+        (*iov)->iov_base = (char *)(*iov)->iov_base + written;
+        (*iov)->iov_len -= written;
+    }
+    return *iovcnt;
+}
+
 #endif
@@ -0,0 +1,496 @@
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_generic_functions.h"
+#include "PB_shm.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PB_SHM_MAGIC 0x50425f53484d3031ull // "PB_SHM01"
+
+enum
+{
+    SIDE_SPAWNER = 0,
+    SIDE_SPAWNED = 1,
+};
+
+typedef struct
+{
+    _Alignas(64) _Atomic uint64_t head; // bytes ever written, owned by the writer
+    _Alignas(64) _Atomic uint64_t tail; // bytes ever read, owned by the reader
+} ring_t;
+
+// Start of the memfd, followed by the data of rings[0] and rings[1].
+typedef struct
+{
+    uint64_t magic;
+    uint64_t ring_size;
+    _Alignas(64) _Atomic uint32_t sleeping[2]; // per side: wake me through my eventfd
+    ring_t rings[2];                           // indexed by writing side
+} layout_t;
+
+struct PB_shm_t
+{
+    layout_t *layout;
+    size_t map_size;
+    char *data[2];
+    int memfd;
+    int wake_fd[2]; // indexed by the side they wake
+    int side;
+    bool watched;
+    bool pipe_closed;
+    char environment[64];
+};
+
+static PB_shm_t *map_shm(int memfd, int wake_spawner, int wake_spawned, int side);
+static size_t ring_write(PB_shm_t *shm, const struct iovec *iov, int iovcnt);
+static size_t ring_read(PB_shm_t *shm, char *destination, size_t size);
+static bool ring_ready(PB_shm_t *shm, bool writing);
+static void wake_peer(PB_shm_t *shm);
+static int sleep_until(PB_shm_t *shm, bool writing, int pipe_fd, short pipe_events, int timeout_ms, short *revents);
+
+//------------------------------------------------------------------------------
+
+PB_shm_t *PB_shm_create(size_t ring_size)
+{
+    if (0 == ring_size || 0 != (ring_size & (ring_size - 1)))
+    {
+        return NULL;
+    }
+
+    int memfd = memfd_create("process_bridge", MFD_CLOEXEC);
+    int wake_spawner = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int wake_spawned = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == memfd || -1 == wake_spawner || -1 == wake_spawned ||
+        -1 == ftruncate(memfd, (off_t)(sizeof(layout_t) + 2 * ring_size)))
+    {
+        close(memfd);
+        close(wake_spawner);
+        close(wake_spawned);
+        return NULL;
+    }
+
+    PB_shm_t *shm = map_shm(memfd, wake_spawner, wake_spawned, SIDE_SPAWNER);
+    if (NULL == shm)
+    {
+        return NULL;
+    }
+    shm->layout->magic = PB_SHM_MAGIC;
+    shm->layout->ring_size = ring_size;
+    shm->data[0] = (char *)shm->layout + sizeof(layout_t);
+    shm->data[1] = shm->data[0] + ring_size;
+    snprintf(shm->environment, sizeof(shm->environment), "%s=%d,%d,%d", PB_SHM_ENVIRONMENT,
+             PB_SHM_CHILD_FD, PB_SHM_CHILD_FD + 1, PB_SHM_CHILD_FD + 2);
+    return shm;
+}
+
+PB_shm_t *PB_shm_attach(void)
+{
+    const char *value = getenv(PB_SHM_ENVIRONMENT);
+    int memfd = -1;
+    int wake_spawner = -1;
+    int wake_spawned = -1;
+    if (NULL == value || 3 != sscanf(value, "%d,%d,%d", &memfd, &wake_spawner, &wake_spawned))
+    {
+        return NULL;
+    }
+    unsetenv(PB_SHM_ENVIRONMENT); // not for our own children
+
+    // Inherited without FD_CLOEXEC so that exec keeps them: restore it.
+    fcntl(memfd, F_SETFD, FD_CLOEXEC);
+    fcntl(wake_spawner, F_SETFD, FD_CLOEXEC);
+    fcntl(wake_spawned, F_SETFD, FD_CLOEXEC);
+
+    PB_shm_t *shm = map_shm(memfd, wake_spawner, wake_spawned, SIDE_SPAWNED);
+    if (NULL == shm)
+    {
+        return NULL;
+    }
+    uint64_t ring_size = shm->layout->ring_size;
+    if (PB_SHM_MAGIC != shm->layout->magic || sizeof(layout_t) + 2 * ring_size != shm->map_size)
+    {
+        PB_shm_destroy(shm);
+        return NULL;
+    }
+    shm->data[0] = (char *)shm->layout + sizeof(layout_t);
+    shm->data[1] = shm->data[0] + ring_size;
+    return shm;
+}
+
+void PB_shm_destroy(PB_shm_t *shm)
+{
+    if (NULL == shm)
+    {
+        return;
+    }
+    munmap(shm->layout, shm->map_size);
+    close(shm->memfd);
+    close(shm->wake_fd[0]);
+    close(shm->wake_fd[1]);
+    free(shm);
+}
+
+const char *PB_shm_environment(const PB_shm_t *shm)
+{
+    return shm->environment;
+}
+
+// Moves the fds to PB_SHM_CHILD_FD.. in the child, through spare numbers
+// above every source and target so that no dup2 overwrites a later source.
+// dup2 copies lose FD_CLOEXEC, the spare ones are closed afterwards.
+int PB_shm_spawn_actions(const PB_shm_t *shm, posix_spawn_file_actions_t *actions)
+{
+    int sources[3] = {shm->memfd, shm->wake_fd[SIDE_SPAWNER], shm->wake_fd[SIDE_SPAWNED]};
+    int spare = PB_SHM_CHILD_FD + 2;
+    for (int i = 0; i < 3; i++)
+    {
+        spare = sources[i] > spare ? sources[i] : spare;
+    }
+    spare++;
+
+    int failed = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        failed |= posix_spawn_file_actions_adddup2(actions, sources[i], spare + i);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        failed |= posix_spawn_file_actions_adddup2(actions, spare + i, PB_SHM_CHILD_FD + i);
+        failed |= posix_spawn_file_actions_addclose(actions, spare + i);
+    }
+    return failed;
+}
+
+ssize_t PB_shm_writev(PB_shm_t *shm, const struct iovec *iov, int iovcnt)
+{
+    size_t written = ring_write(shm, iov, iovcnt);
+    if (0 == written)
+    {
+        for (int i = 0; i < iovcnt; i++)
+        {
+            if (iov[i].iov_len > 0)
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+        }
+    }
+    return (ssize_t)written;
+}
+
+int PB_shm_wait_writable(PB_shm_t *shm, int pipe_fd)
+{
+    // The pipe is only watched for POLLERR: the reader closed its end.
+    short revents = 0;
+    int result = sleep_until(shm, true, pipe_fd, 0, -1, &revents);
+    return -1 == result || (revents & (POLLERR | POLLNVAL)) ? 1 : 0;
+}
+
+PB_status_t PB_shm_read_some(PB_shm_t *shm, int pipe_fd, char *destination, size_t size, int timeout_ms, size_t *bytes_read)
+{
+    int64_t deadline = timeout_ms < 0 ? PB_NO_DEADLINE : PB_monotonic_ms() + timeout_ms;
+    while (true)
+    {
+        *bytes_read = ring_read(shm, destination, size);
+        if (*bytes_read > 0)
+        {
+            return PB_STATUS_OK;
+        }
+
+        // Whatever was written straight to the pipe (e.g. with printf).
+        if (!shm->pipe_closed)
+        {
+            struct pollfd pfd = {.fd = pipe_fd, .events = POLLIN};
+            if (1 == poll(&pfd, 1, 0))
+            {
+                ssize_t result;
+                do
+                {
+                    result = read(pipe_fd, destination, size);
+                } while (-1 == result && EINTR == errno);
+
+                if (result > 0)
+                {
+                    *bytes_read = (size_t)result;
+                    return PB_STATUS_OK;
+                }
+                if (0 == result)
+                {
+                    shm->pipe_closed = true; // the peer is gone: drain the ring, then EOF
+                    continue;
+                }
+                if (EAGAIN != errno && EWOULDBLOCK != errno)
+                {
+                    return PB_STATUS_GENERIC_ERROR;
+                }
+            }
+        }
+        else
+        {
+            return PB_STATUS_OK;
+        }
+
+        int remaining = -1;
+        if (PB_NO_DEADLINE != deadline)
+        {
+            int64_t left = deadline - PB_monotonic_ms();
+            if (left <= 0)
+            {
+                return PB_STATUS_TIMEOUT;
+            }
+            remaining = left < INT32_MAX ? (int)left : INT32_MAX;
+        }
+        short revents = 0;
+        if (-1 == sleep_until(shm, false, pipe_fd, POLLIN, remaining, &revents))
+        {
+            return PB_STATUS_GENERIC_ERROR;
+        }
+    }
+}
+
+int PB_shm_wake_fd(const PB_shm_t *shm)
+{
+    return shm->wake_fd[shm->side];
+}
+
+void PB_shm_watch(PB_shm_t *shm, bool watched)
+{
+    shm->watched = watched;
+    atomic_store(&shm->layout->sleeping[shm->side], watched ? 1 : 0);
+}
+
+void PB_shm_clear_wake(PB_shm_t *shm)
+{
+    eventfd_t value;
+    eventfd_read(shm->wake_fd[shm->side], &value);
+}
+
+//------------------------------------------------------------------------------
+
+static PB_shm_t *map_shm(int memfd, int wake_spawner, int wake_spawned, int side)
+{
+    struct stat info;
+    PB_shm_t *shm = (PB_shm_t *)malloc(sizeof(PB_shm_t));
+    void *map = MAP_FAILED;
+    if (NULL != shm && 0 == fstat(memfd, &info) && (size_t)info.st_size > sizeof(layout_t))
+    {
+        map = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (MAP_FAILED == map)
+    {
+        free(shm);
+        close(memfd);
+        close(wake_spawner);
+        close(wake_spawned);
+        return NULL;
+    }
+
+    shm->layout = (layout_t *)map;
+    shm->map_size = (size_t)info.st_size;
+    shm->data[0] = NULL;
+    shm->data[1] = NULL;
+    shm->memfd = memfd;
+    shm->wake_fd[SIDE_SPAWNER] = wake_spawner;
+    shm->wake_fd[SIDE_SPAWNED] = wake_spawned;
+    shm->side = side;
+    shm->watched = false;
+    shm->pipe_closed = false;
+    shm->environment[0] = '\0';
+    return shm;
+}
+
+// Copies as much of the iovecs as fits, returns the number of bytes written.
+static size_t ring_write(PB_shm_t *shm, const struct iovec *iov, int iovcnt)
+{
+    ring_t *ring = &shm->layout->rings[shm->side];
+    char *data = shm->data[shm->side];
+    size_t ring_size = shm->layout->ring_size;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t space = ring_size - (size_t)(head - tail);
+
+    size_t written = 0;
+    for (int i = 0; i < iovcnt && written < space; i++)
+    {
+        size_t n = iov[i].iov_len < space - written ? iov[i].iov_len : space - written;
+        size_t offset = (size_t)(head + written) & (ring_size - 1);
+        size_t first = n < ring_size - offset ? n : ring_size - offset;
+        memcpy(data + offset, iov[i].iov_base, first);
+        memcpy(data, (const char *)iov[i].iov_base + first, n - first);
+        written += n;
+    }
+
+    if (written > 0)
+    {
+        atomic_store_explicit(&ring->head, head + written, memory_order_release);
+        wake_peer(shm);
+    }
+    return written;
+}
+
+static size_t ring_read(PB_shm_t *shm, char *destination, size_t size)
+{
+    int peer = 1 - shm->side;
+    ring_t *ring = &shm->layout->rings[peer];
+    const char *data = shm->data[peer];
+    size_t ring_size = shm->layout->ring_size;
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t available = (size_t)(head - tail);
+
+    size_t n = size < available ? size : available;
+    if (n > 0)
+    {
+        size_t offset = (size_t)tail & (ring_size - 1);
+        size_t first = n < ring_size - offset ? n : ring_size - offset;
+        memcpy(destination, data + offset, first);
+        memcpy(destination + first, data, n - first);
+        atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+        wake_peer(shm); // a writer may wait for room
+    }
+    return n;
+}
+
+static bool ring_ready(PB_shm_t *shm, bool writing)
+{
+    int index = writing ? shm->side : 1 - shm->side;
+    ring_t *ring = &shm->layout->rings[index];
+    uint64_t used = atomic_load(&ring->head) - atomic_load(&ring->tail);
+    return writing ? used < shm->layout->ring_size : used > 0;
+}
+
+// Pairs with the store of the sleeping flag in sleep_until: either the
+// sleeper sees the new head/tail, or we see it sleeping.
+static void wake_peer(PB_shm_t *shm)
+{
+    int peer = 1 - shm->side;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&shm->layout->sleeping[peer], memory_order_relaxed))
+    {
+        eventfd_write(shm->wake_fd[peer], 1);
+    }
+}
+
+// Sleeps until the ring is ready, the peer signals, or pipe_fd has events.
+static int sleep_until(PB_shm_t *shm, bool writing, int pipe_fd, short pipe_events, int timeout_ms, short *revents)
+{
+    _Atomic uint32_t *sleeping = &shm->layout->sleeping[shm->side];
+    atomic_store(sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int ready = 0;
+    if (!ring_ready(shm, writing))
+    {
+        struct pollfd pfds[2] = {
+            {.fd = shm->wake_fd[shm->side], .events = POLLIN},
+            {.fd = pipe_fd, .events = pipe_events},
+        };
+        do
+        {
+            ready = poll(pfds, 2, timeout_ms);
+        } while (-1 == ready && EINTR == errno);
+        *revents = pfds[1].revents;
+    }
+
+    if (!shm->watched)
+    {
+        atomic_store(sleeping, 0);
+    }
+    PB_shm_clear_wake(shm);
+    return -1 == ready ? -1 : 0;
+}
+
+#else // no memfd
+
+PB_shm_t *PB_shm_create(size_t ring_size)
+{
+    (void)ring_size;
+    return NULL;
+}
+
+PB_shm_t *PB_shm_attach(void)
+{
+    return NULL;
+}
+
+void PB_shm_destroy(PB_shm_t *shm)
+{
+    (void)shm;
+}
+
+#ifndef _WIN32
+
+const char *PB_shm_environment(const PB_shm_t *shm)
+{
+    (void)shm;
+    return "";
+}
+
+int PB_shm_spawn_actions(const PB_shm_t *shm, posix_spawn_file_actions_t *actions)
+{
+    (void)shm;
+    (void)actions;
+    return 1;
+}
+
+ssize_t PB_shm_writev(PB_shm_t *shm, const struct iovec *iov, int iovcnt)
+{
+    (void)shm;
+    (void)iov;
+    (void)iovcnt;
+    return -1;
+}
+
+int PB_shm_wait_writable(PB_shm_t *shm, int pipe_fd)
+{
+    (void)shm;
+    (void)pipe_fd;
+    return 1;
+}
+
+PB_status_t PB_shm_read_some(PB_shm_t *shm, int pipe_fd, char *destination, size_t size, int timeout_ms, size_t *bytes_read)
+{
+    (void)shm;
+    (void)pipe_fd;
+    (void)destination;
+    (void)size;
+    (void)timeout_ms;
+    *bytes_read = 0;
+    return PB_STATUS_GENERIC_ERROR;
+}
+
+int PB_shm_wake_fd(const PB_shm_t *shm)
+{
+    (void)shm;
+    return -1;
+}
+
+void PB_shm_watch(PB_shm_t *shm, bool watched)
+{
+    (void)shm;
+    (void)watched;
+}
+
+void PB_shm_clear_wake(PB_shm_t *shm)
+{
+    (void)shm;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "process_bridge.h"
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#endif
+
+// Shared-memory transport: one memfd holding a single-producer single-consumer
+// byte ring per direction, plus one eventfd per side to wake it up when it
+// sleeps. The pipes stay open next to it for stderr, EOF and peer death.
+
+#define PB_SHM_RING_SIZE_DEFAULT ((size_t)1 << 20) // power of two
+#define PB_SHM_ENVIRONMENT "PB_SHARED_MEMORY"
+#define PB_SHM_CHILD_FD 3 // the child finds the memfd and both eventfds from here
+
+struct PB_shm_t;
+
+// Spawning side. The spawned side attaches to what the environment names,
+// or gets NULL.
+PB_shm_t *PB_shm_create(size_t ring_size);
+PB_shm_t *PB_shm_attach(void);
+void PB_shm_destroy(PB_shm_t *shm);
+
+#ifndef _WIN32
+// "PB_SHARED_MEMORY=..." entry and file actions passing the ring to a child.
+const char *PB_shm_environment(const PB_shm_t *shm);
+int PB_shm_spawn_actions(const PB_shm_t *shm, posix_spawn_file_actions_t *actions);
+
+// Never blocks: -1 with errno EAGAIN when the ring is full.
+ssize_t PB_shm_writev(PB_shm_t *shm, const struct iovec *iov, int iovcnt);
+// Blocks until there is room, 1 when pipe_fd reports the reader gone.
+int PB_shm_wait_writable(PB_shm_t *shm, int pipe_fd);
+// Same contract as read_some: ring first, then pipe_fd; 0 bytes is EOF,
+// reached once the pipe is closed and the ring empty.
+PB_status_t PB_shm_read_some(PB_shm_t *shm, int pipe_fd, char *destination, size_t size, int timeout_ms, size_t *bytes_read);
+
+// For event loops: while watched, the peer signals the wake fd on every
+// write or read instead of only when this side sleeps.
+int PB_shm_wake_fd(const PB_shm_t *shm);
+void PB_shm_watch(PB_shm_t *shm, bool watched);
+void PB_shm_clear_wake(PB_shm_t *shm);
+#endif
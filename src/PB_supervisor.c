@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "PB_generic_functions.h"
+#include "PB_internal.h"
+#include "process_bridge.h"
+
+#define PB_SUPERVISOR_BACKOFF_INITIAL_MS 10
+#define PB_SUPERVISOR_BACKOFF_MAX_MS 5000
+#define PB_SUPERVISOR_STABLE_MS 10000
+#define PB_SUPERVISOR_VIEWS 64
+
+typedef enum
+{
+    SUPERVISED_DOWN,     // waiting for the backoff to elapse
+    SUPERVISED_STARTING, // spawned, handshake pending
+    SUPERVISED_UP,
+} supervised_state_t;
+
+struct PB_supervisor_t
+{
+    char *command;
+    PB_supervisor_options_t options;
+    char *ready_line;
+    char *handshake; // mailbox for the ready line, one byte larger to catch longer lines
+    size_t handshake_size;
+
+    supervised_state_t state;
+    PB_process_t *process;
+    int64_t restart_at; // DOWN: when to spawn again
+    int64_t up_since;
+    unsigned failures; // consecutive, reset by a stable run
+    size_t restarts;
+};
+
+static void start(PB_supervisor_t *supervisor);
+static void handshake(PB_supervisor_t *supervisor, int timeout_ms);
+static void dispatch(PB_supervisor_t *supervisor, int timeout_ms);
+static void crashed(PB_supervisor_t *supervisor, bool spawned);
+static void hand_back(const char *message, size_t length, PB_response_callback_t callback, void *user_data, void *context);
+static int remaining_ms(int64_t deadline);
+
+//------------------------------------------------------------------------------
+
+PB_supervisor_t *PB_supervisor_create(const char *command, const PB_supervisor_options_t *options)
+{
+    if (NULL == command)
+    {
+        return NULL;
+    }
+
+    PB_supervisor_t *supervisor = (PB_supervisor_t *)calloc(1, sizeof(PB_supervisor_t));
+    if (NULL == supervisor)
+    {
+        return NULL;
+    }
+    if (NULL != options)
+    {
+        supervisor->options = *options;
+    }
+    if (0 >= supervisor->options.backoff_initial_ms)
+    {
+        supervisor->options.backoff_initial_ms = PB_SUPERVISOR_BACKOFF_INITIAL_MS;
+    }
+    if (0 >= supervisor->options.backoff_max_ms)
+    {
+        supervisor->options.backoff_max_ms = PB_SUPERVISOR_BACKOFF_MAX_MS;
+    }
+    if (0 >= supervisor->options.stable_ms)
+    {
+        supervisor->options.stable_ms = PB_SUPERVISOR_STABLE_MS;
+    }
+
+    supervisor->command = PB_string_clone(command, strlen(command));
+    bool allocation_error = NULL == supervisor->command;
+    if (NULL != supervisor->options.ready_line)
+    {
+        size_t length = strlen(supervisor->options.ready_line);
+        supervisor->ready_line = PB_string_clone(supervisor->options.ready_line, length);
+        supervisor->options.ready_line = supervisor->ready_line;
+        supervisor->handshake_size = length + 2;
+        supervisor->handshake = (char *)malloc(supervisor->handshake_size);
+        allocation_error = allocation_error || NULL == supervisor->ready_line || NULL == supervisor->handshake;
+    }
+    if (allocation_error)
+    {
+        PB_supervisor_destroy(supervisor);
+        return NULL;
+    }
+
+    supervisor->state = SUPERVISED_DOWN;
+    supervisor->restart_at = PB_monotonic_ms();
+    start(supervisor);
+    return supervisor;
+}
+
+void PB_supervisor_destroy(PB_supervisor_t *supervisor)
+{
+    if (NULL == supervisor)
+    {
+        return;
+    }
+
+    if (NULL != supervisor->process)
+    {
+        PB_cancel_requests(supervisor->process);
+        PB_despawn(supervisor->process);
+        PB_destroy(supervisor->process);
+    }
+    free(supervisor->command);
+    free(supervisor->ready_line);
+    free(supervisor->handshake);
+    free(supervisor);
+}
+
+PB_process_t *PB_supervisor_process(const PB_supervisor_t *supervisor)
+{
+    return NULL != supervisor && SUPERVISED_UP == supervisor->state ? supervisor->process : NULL;
+}
+
+size_t PB_supervisor_restarts(const PB_supervisor_t *supervisor)
+{
+    return NULL == supervisor ? 0 : supervisor->restarts;
+}
+
+PB_status_t PB_supervisor_poll(PB_supervisor_t *supervisor, int timeout_ms)
+{
+    if (NULL == supervisor)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    int64_t deadline = timeout_ms < 0 ? PB_NO_DEADLINE : PB_monotonic_ms() + timeout_ms;
+    for (;;)
+    {
+        switch (supervisor->state)
+        {
+        case SUPERVISED_UP:
+            dispatch(supervisor, remaining_ms(deadline));
+            if (SUPERVISED_UP == supervisor->state)
+            {
+                return PB_STATUS_OK;
+            }
+            break; // crashed: respawn within the same call if time allows
+        case SUPERVISED_DOWN:
+        {
+            int64_t wait = supervisor->restart_at - PB_monotonic_ms();
+            int remaining = remaining_ms(deadline);
+            if (wait > 0)
+            {
+                PB_sleep_ms(remaining >= 0 && remaining < wait ? remaining : (int)wait);
+            }
+            start(supervisor);
+            break;
+        }
+        case SUPERVISED_STARTING:
+            handshake(supervisor, remaining_ms(deadline));
+            if (SUPERVISED_UP == supervisor->state)
+            {
+                return PB_STATUS_OK;
+            }
+            break;
+        }
+
+        if (PB_NO_DEADLINE != deadline && PB_monotonic_ms() >= deadline)
+        {
+            return SUPERVISED_UP == supervisor->state ? PB_STATUS_OK : PB_STATUS_TERMINATED;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Spawns if the backoff elapsed, staying DOWN with a new backoff on failure.
+static void start(PB_supervisor_t *supervisor)
+{
+    if (PB_monotonic_ms() < supervisor->restart_at)
+    {
+        return;
+    }
+
+    PB_process_t *process = PB_create_framed(PB_TYPE_CHILD, supervisor->options.framing);
+    if (NULL != process)
+    {
+        process->retain_requests = NULL != supervisor->options.handback;
+    }
+    if (NULL == process || PB_STATUS_OK != PB_spawn(process, supervisor->command))
+    {
+        supervisor->process = process;
+        crashed(supervisor, false);
+        return;
+    }
+    supervisor->process = process;
+    supervisor->state = SUPERVISED_STARTING;
+    if (NULL == supervisor->ready_line)
+    {
+        supervisor->state = SUPERVISED_UP;
+        supervisor->up_since = PB_monotonic_ms();
+    }
+}
+
+static void handshake(PB_supervisor_t *supervisor, int timeout_ms)
+{
+    PB_process_t *process = supervisor->process;
+    PB_status_t status;
+    size_t length = 0;
+    if (PB_FRAMING_LENGTH_PREFIXED == process->framing)
+    {
+        status = PB_receive_bytes_timeout(process, supervisor->handshake, supervisor->handshake_size - 1, &length, timeout_ms);
+        supervisor->handshake[PB_STATUS_OK == status ? length : 0] = '\0';
+    }
+    else
+    {
+        status = PB_receive_timeout(process, supervisor->handshake, supervisor->handshake_size, timeout_ms);
+    }
+
+    if (PB_STATUS_TIMEOUT == status)
+    {
+        return;
+    }
+    if (PB_STATUS_OK != status || 0 != strcmp(supervisor->handshake, supervisor->ready_line))
+    {
+        crashed(supervisor, true);
+        return;
+    }
+    supervisor->state = SUPERVISED_UP;
+    supervisor->up_since = PB_monotonic_ms();
+}
+
+// Responses go to their requests; end of file or exit means a crash.
+static void dispatch(PB_supervisor_t *supervisor, int timeout_ms)
+{
+    PB_process_t *process = supervisor->process;
+    PB_message_view_t views[PB_SUPERVISOR_VIEWS];
+    size_t count = 0;
+    bool eof = false;
+    PB_status_t status = PB_receive_views(process, false, views, PB_SUPERVISOR_VIEWS, &count, timeout_ms, &eof);
+    for (size_t i = 0; i < count; i++)
+    {
+        PB_handle_response(process, views[i].data, views[i].length);
+    }
+
+    if (eof || (PB_STATUS_OK != status && PB_STATUS_TIMEOUT != status) ||
+        (PB_STATUS_TIMEOUT == status && PB_STATUS_OK == PB_poll_exit(process)))
+    {
+        crashed(supervisor, true);
+    }
+}
+
+// Hands the unanswered requests back, then schedules the next spawn: right
+// away after a stable run, then with a doubling delay.
+static void crashed(PB_supervisor_t *supervisor, bool spawned)
+{
+    int64_t now = PB_monotonic_ms();
+    if (SUPERVISED_UP == supervisor->state && now - supervisor->up_since >= supervisor->options.stable_ms)
+    {
+        supervisor->failures = 0;
+    }
+
+    PB_process_t *process = supervisor->process;
+    supervisor->process = NULL;
+    supervisor->state = SUPERVISED_DOWN;
+    if (NULL != process)
+    {
+        if (NULL != supervisor->options.handback)
+        {
+            PB_take_requests(process, hand_back, supervisor);
+        }
+        PB_cancel_requests(process);
+        if (spawned)
+        {
+            PB_despawn(process);
+        }
+        PB_destroy(process);
+    }
+
+    int64_t delay = 0;
+    if (0 != supervisor->failures)
+    {
+        delay = supervisor->options.backoff_initial_ms;
+        for (unsigned i = 1; i < supervisor->failures && delay < supervisor->options.backoff_max_ms; i++)
+        {
+            delay *= 2;
+        }
+        delay = delay < supervisor->options.backoff_max_ms ? delay : supervisor->options.backoff_max_ms;
+    }
+    supervisor->failures++;
+    supervisor->restarts++;
+    supervisor->restart_at = now + delay;
+}
+
+static void hand_back(const char *message, size_t length, PB_response_callback_t callback, void *user_data, void *context)
+{
+    PB_supervisor_t *supervisor = (PB_supervisor_t *)context;
+    supervisor->options.handback(supervisor, message, length, callback, user_data, supervisor->options.user_data);
+}
+
+static int remaining_ms(int64_t deadline)
+{
+    if (PB_NO_DEADLINE == deadline)
+    {
+        return -1;
+    }
+    int64_t remaining = deadline - PB_monotonic_ms();
+    return remaining > 0 ? (remaining < INT_MAX ? (int)remaining : INT_MAX) : 0;
+}
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_buffer.h"
+#include "PB_internal.h"
+#include "process_bridge.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define PB_THREADED_VIEWS 64
+
+// A request on its way from any application thread to the I/O thread.
+typedef struct submission_t submission_t;
+struct submission_t
+{
+    _Atomic(submission_t *) next;
+    PB_response_callback_t callback;
+    void *user_data;
+    size_t length;
+    char data[]; // copied, the submitter's buffer is free on return
+};
+
+// Intrusive MPSC queue (Vyukov): producers only exchange the head, the
+// consumer walks from the tail. The stub keeps it never empty.
+typedef struct
+{
+    _Alignas(64) _Atomic(submission_t *) head;
+    _Alignas(64) submission_t *tail;
+    submission_t stub;
+} mpsc_t;
+
+struct PB_threaded_t
+{
+    PB_process_t *process;
+    pthread_t thread;
+    mpsc_t queue;
+    int wake[2];
+    _Atomic bool sleeping; // the I/O thread is (about to be) in poll()
+    _Atomic bool stopping;
+    _Atomic bool closed; // child's stdout reached EOF
+};
+
+// Completion slot of PB_threaded_call: written once by the I/O thread, read
+// once by the calling thread.
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    bool done;
+    PB_status_t status;
+    void *response;
+    size_t size;
+    size_t *length;
+} call_t;
+
+static void *io_thread(void *argument);
+static void mpsc_init(mpsc_t *queue);
+static void mpsc_push(mpsc_t *queue, submission_t *submission);
+static submission_t *mpsc_pop(mpsc_t *queue);
+static void submit_all(PB_threaded_t *threaded);
+static void fail(submission_t *submission);
+static void wake_up(PB_threaded_t *threaded);
+static void complete_call(PB_process_t *process, PB_status_t status, const char *response, size_t length, void *user_data);
+
+//------------------------------------------------------------------------------
+
+PB_threaded_t *PB_threaded_create(PB_process_t *child)
+{
+    if (NULL == child || PB_TYPE_CHILD != child->type || -1 == child->stdin_fd || NULL != child->shm)
+    {
+        return NULL;
+    }
+
+    PB_threaded_t *threaded = (PB_threaded_t *)malloc(sizeof(PB_threaded_t));
+    if (NULL == threaded)
+    {
+        return NULL;
+    }
+    threaded->process = child;
+    mpsc_init(&threaded->queue);
+    atomic_init(&threaded->sleeping, false);
+    atomic_init(&threaded->stopping, false);
+    atomic_init(&threaded->closed, false);
+    if (PB_open_pipe(threaded->wake, 0))
+    {
+        free(threaded);
+        return NULL;
+    }
+    fcntl(threaded->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(threaded->wake[1], F_SETFL, O_NONBLOCK);
+
+    // Queued sends instead of blocking writes: the thread must keep reading.
+    if (PB_STATUS_OK != PB_set_nonblocking(child, true) ||
+        0 != pthread_create(&threaded->thread, NULL, io_thread, threaded))
+    {
+        PB_close_pipe(threaded->wake);
+        free(threaded);
+        return NULL;
+    }
+    return threaded;
+}
+
+void PB_threaded_destroy(PB_threaded_t *threaded)
+{
+    if (NULL == threaded)
+    {
+        return;
+    }
+
+    atomic_store(&threaded->stopping, true);
+    wake_up(threaded);
+    pthread_join(threaded->thread, NULL);
+
+    // Whatever was submitted meanwhile or is still in flight fails.
+    submission_t *submission;
+    while (NULL != (submission = mpsc_pop(&threaded->queue)))
+    {
+        fail(submission);
+    }
+    PB_cancel_requests(threaded->process);
+    PB_close_pipe(threaded->wake);
+    free(threaded);
+}
+
+PB_status_t PB_threaded_request(PB_threaded_t *threaded, const void *data, size_t length, PB_response_callback_t callback, void *user_data)
+{
+    if (NULL == threaded || NULL == data || NULL == callback)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+    if (atomic_load(&threaded->closed))
+    {
+        return PB_STATUS_TERMINATED;
+    }
+
+    submission_t *submission = (submission_t *)malloc(sizeof(submission_t) + length);
+    if (NULL == submission)
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    submission->callback = callback;
+    submission->user_data = user_data;
+    submission->length = length;
+    memcpy(submission->data, data, length);
+    mpsc_push(&threaded->queue, submission);
+    wake_up(threaded);
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_threaded_call(PB_threaded_t *threaded, const void *data, size_t length, void *response, size_t size, size_t *response_length)
+{
+    if (NULL == response || NULL == response_length)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    call_t call;
+    pthread_mutex_init(&call.mutex, NULL);
+    pthread_cond_init(&call.done_cond, NULL);
+    call.done = false;
+    call.status = PB_STATUS_GENERIC_ERROR;
+    call.response = response;
+    call.size = size;
+    call.length = response_length;
+
+    PB_status_t status = PB_threaded_request(threaded, data, length, complete_call, &call);
+    if (PB_STATUS_OK == status)
+    {
+        pthread_mutex_lock(&call.mutex);
+        while (!call.done)
+        {
+            pthread_cond_wait(&call.done_cond, &call.mutex);
+        }
+        pthread_mutex_unlock(&call.mutex);
+        status = call.status;
+    }
+    pthread_cond_destroy(&call.done_cond);
+    pthread_mutex_destroy(&call.mutex);
+    return status;
+}
+
+//------------------------------------------------------------------------------
+
+static void *io_thread(void *argument)
+{
+    PB_threaded_t *threaded = (PB_threaded_t *)argument;
+    PB_process_t *process = threaded->process;
+    PB_message_view_t views[PB_THREADED_VIEWS];
+
+    while (!atomic_load(&threaded->stopping))
+    {
+        submit_all(threaded);
+
+        // Announce the sleep, then look again: a push racing with it either
+        // is seen here or finds sleeping set and writes the wake pipe.
+        atomic_store(&threaded->sleeping, true);
+        submit_all(threaded);
+
+        bool writing = NULL != process->send_buffer && PB_buffer_length(process->send_buffer) > 0;
+        bool closed = atomic_load(&threaded->closed);
+        struct pollfd pfds[3] = {
+            {threaded->wake[0], POLLIN, 0},
+            {closed ? -1 : process->stdout_fd, POLLIN, 0},
+            {writing && !closed ? process->stdin_fd : -1, POLLOUT, 0},
+        };
+        int ready = poll(pfds, 3, -1);
+        atomic_store(&threaded->sleeping, false);
+        if (-1 == ready)
+        {
+            continue; // EINTR
+        }
+
+        if (pfds[0].revents)
+        {
+            char drain[64];
+            while (read(threaded->wake[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        if (pfds[2].revents)
+        {
+            PB_flush(process);
+        }
+        if (pfds[1].revents)
+        {
+            size_t count = 0;
+            bool eof = false;
+            PB_receive_views(process, false, views, PB_THREADED_VIEWS, &count, 0, &eof);
+            for (size_t i = 0; i < count; i++)
+            {
+                PB_handle_response(process, views[i].data, views[i].length);
+            }
+            if (eof)
+            {
+                atomic_store(&threaded->closed, true);
+                PB_cancel_requests(process);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void mpsc_init(mpsc_t *queue)
+{
+    atomic_init(&queue->stub.next, NULL);
+    atomic_init(&queue->head, &queue->stub);
+    queue->tail = &queue->stub;
+}
+
+static void mpsc_push(mpsc_t *queue, submission_t *submission)
+{
+    atomic_store_explicit(&submission->next, NULL, memory_order_relaxed);
+    submission_t *previous = atomic_exchange_explicit(&queue->head, submission, memory_order_acq_rel);
+    atomic_store_explicit(&previous->next, submission, memory_order_release);
+}
+
+// NULL when empty, or while a producer is between its two steps (the next
+// round picks it up: it wakes us after its push anyway).
+static submission_t *mpsc_pop(mpsc_t *queue)
+{
+    submission_t *tail = queue->tail;
+    submission_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (&queue->stub == tail)
+    {
+        if (NULL == next)
+        {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (NULL != next)
+    {
+        queue->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&queue->head, memory_order_acquire))
+    {
+        return NULL;
+    }
+    mpsc_push(queue, &queue->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (NULL != next)
+    {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static void submit_all(PB_threaded_t *threaded)
+{
+    submission_t *submission;
+    while (NULL != (submission = mpsc_pop(&threaded->queue)))
+    {
+        if (atomic_load(&threaded->closed) ||
+            PB_STATUS_OK != PB_request_bytes(threaded->process, submission->data, submission->length, submission->callback, submission->user_data, NULL))
+        {
+            fail(submission);
+            continue;
+        }
+        free(submission);
+    }
+}
+
+static void fail(submission_t *submission)
+{
+    submission->callback(NULL, PB_STATUS_TERMINATED, NULL, 0, submission->user_data);
+    free(submission);
+}
+
+static void wake_up(PB_threaded_t *threaded)
+{
+    if (atomic_exchange(&threaded->sleeping, false))
+    {
+        if (1 != write(threaded->wake[1], "", 1))
+        {
+            // full pipe: a wake-up is already pending
+        }
+    }
+}
+
+static void complete_call(PB_process_t *process, PB_status_t status, const char *response, size_t length, void *user_data)
+{
+    (void)process;
+    call_t *call = (call_t *)user_data;
+    pthread_mutex_lock(&call->mutex);
+    *call->length = length;
+    if (PB_STATUS_OK == status && length > call->size)
+    {
+        status = PB_STATUS_GENERIC_ERROR; // *length tells the size needed
+    }
+    else if (PB_STATUS_OK == status)
+    {
+        memcpy(call->response, response, length);
+    }
+    call->status = status;
+    call->done = true;
+    pthread_cond_signal(&call->done_cond);
+    pthread_mutex_unlock(&call->mutex);
+}
+
+#else // _WIN32
+
+PB_threaded_t *PB_threaded_create(PB_process_t *child)
+{
+    (void)child;
+    return NULL;
+}
+
+void PB_threaded_destroy(PB_threaded_t *threaded)
+{
+    (void)threaded;
+}
+
+PB_status_t PB_threaded_request(PB_threaded_t *threaded, const void *data, size_t length, PB_response_callback_t callback, void *user_data)
+{
+    (void)threaded;
+    (void)data;
+    (void)length;
+    (void)callback;
+    (void)user_data;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_threaded_call(PB_threaded_t *threaded, const void *data, size_t length, void *response, size_t size, size_t *response_length)
+{
+    (void)threaded;
+    (void)data;
+    (void)length;
+    (void)response;
+    (void)size;
+    (void)response_length;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+#endif
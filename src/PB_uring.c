@@ -0,0 +1,305 @@
+#include "PB_uring.h"
+
+#if defined(__linux__) && defined(PB_HAVE_IO_URING)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct PB_uring_t
+{
+    int fd;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map; // same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head; // shared with the kernel
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned tail; // queued locally, published by PB_uring_enter
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static struct io_uring_sqe *next_sqe(PB_uring_t *ring);
+
+//------------------------------------------------------------------------------
+
+PB_uring_t *PB_uring_create(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = PB_URING_COMPLETIONS;
+    int fd = (int)syscall(__NR_io_uring_setup, PB_URING_ENTRIES, &params);
+    if (-1 == fd)
+    {
+        return NULL;
+    }
+
+    // Timeouts go through IORING_ENTER_EXT_ARG, and no completion may be dropped.
+    unsigned required = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+    PB_uring_t *ring = (PB_uring_t *)calloc(1, sizeof(PB_uring_t));
+    if (NULL == ring || required != (params.features & required))
+    {
+        free(ring);
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->sq_map = MAP_FAILED;
+    ring->cq_map = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+    if (single && ring->cq_map_size > ring->sq_map_size)
+    {
+        ring->sq_map_size = ring->cq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring->sq_map)
+    {
+        PB_uring_destroy(ring);
+        return NULL;
+    }
+    ring->cq_map = single ? ring->sq_map : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (MAP_FAILED == ring->cq_map || MAP_FAILED == (void *)ring->sqes)
+    {
+        PB_uring_destroy(ring);
+        return NULL;
+    }
+
+    char *sq = (char *)ring->sq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->tail = *ring->sq_tail;
+
+    char *cq = (char *)ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+void PB_uring_destroy(PB_uring_t *ring)
+{
+    if (NULL == ring)
+    {
+        return;
+    }
+
+    if (MAP_FAILED != (void *)ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (MAP_FAILED != ring->cq_map && ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (MAP_FAILED != ring->sq_map)
+    {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    close(ring->fd); // also releases the registered buffers
+    free(ring);
+}
+
+bool PB_uring_register_buffers(PB_uring_t *ring, const struct iovec *iov, unsigned count)
+{
+    return 0 == syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, count);
+}
+
+bool PB_uring_read(PB_uring_t *ring, int fd, void *buffer, unsigned size, int fixed_index, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = next_sqe(ring);
+    if (NULL == sqe)
+    {
+        return false;
+    }
+    sqe->opcode = fixed_index < 0 ? IORING_OP_READ : IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = size;
+    sqe->off = (uint64_t)-1; // pipes have no offset
+    sqe->buf_index = fixed_index < 0 ? 0 : (uint16_t)fixed_index;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool PB_uring_poll(PB_uring_t *ring, int fd, unsigned events, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = next_sqe(ring);
+    if (NULL == sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool PB_uring_cancel(PB_uring_t *ring, uint64_t target, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = next_sqe(ring);
+    if (NULL == sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+    return true;
+}
+
+int PB_uring_enter(PB_uring_t *ring, int timeout_ms)
+{
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    // Completions already waiting are reaped without sleeping.
+    bool ready = *ring->cq_head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned wait = 0 == timeout_ms || ready ? 0 : 1;
+    if (0 == to_submit && 0 == wait)
+    {
+        return 0;
+    }
+
+    struct __kernel_timespec timeout = {.tv_sec = timeout_ms / 1000, .tv_nsec = (long long)(timeout_ms % 1000) * 1000000};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = timeout_ms > 0 ? (uint64_t)(uintptr_t)&timeout : 0;
+
+    unsigned flags = 0 == wait ? 0 : IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    long result = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait, flags, 0 == wait ? NULL : &arg, 0 == wait ? 0 : sizeof(arg));
+    if (-1 == result && EINTR != errno && ETIME != errno && EBUSY != errno)
+    {
+        return -1; // EBUSY: the completion queue is full, reaping makes room
+    }
+    return 0;
+}
+
+bool PB_uring_complete(PB_uring_t *ring, uint64_t *user_data, int32_t *result)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// A cleared slot of the submission queue, submitting early when it is full.
+static struct io_uring_sqe *next_sqe(PB_uring_t *ring)
+{
+    if (ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        PB_uring_enter(ring, 0);
+        if (ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+        {
+            return NULL;
+        }
+    }
+
+    unsigned index = ring->tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->tail++;
+    return sqe;
+}
+
+#elif defined(__linux__) // built without io_uring
+
+PB_uring_t *PB_uring_create(void)
+{
+    return NULL;
+}
+
+void PB_uring_destroy(PB_uring_t *ring)
+{
+    (void)ring;
+}
+
+bool PB_uring_register_buffers(PB_uring_t *ring, const struct iovec *iov, unsigned count)
+{
+    (void)ring;
+    (void)iov;
+    (void)count;
+    return false;
+}
+
+bool PB_uring_read(PB_uring_t *ring, int fd, void *buffer, unsigned size, int fixed_index, uint64_t user_data)
+{
+    (void)ring;
+    (void)fd;
+    (void)buffer;
+    (void)size;
+    (void)fixed_index;
+    (void)user_data;
+    return false;
+}
+
+bool PB_uring_poll(PB_uring_t *ring, int fd, unsigned events, uint64_t user_data)
+{
+    (void)ring;
+    (void)fd;
+    (void)events;
+    (void)user_data;
+    return false;
+}
+
+bool PB_uring_cancel(PB_uring_t *ring, uint64_t target, uint64_t user_data)
+{
+    (void)ring;
+    (void)target;
+    (void)user_data;
+    return false;
+}
+
+int PB_uring_enter(PB_uring_t *ring, int timeout_ms)
+{
+    (void)ring;
+    (void)timeout_ms;
+    return -1;
+}
+
+bool PB_uring_complete(PB_uring_t *ring, uint64_t *user_data, int32_t *result)
+{
+    (void)ring;
+    (void)user_data;
+    (void)result;
+    return false;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <sys/uio.h>
+
+// Minimal io_uring over the raw syscalls, backing the event loop. Only built
+// with PB_HAVE_IO_URING: otherwise, or when the kernel refuses to set a ring
+// up (too old, seccomp, io_uring_disabled), PB_uring_create returns NULL.
+
+#define PB_URING_ENTRIES 256
+#define PB_URING_COMPLETIONS 4096 // one per operation in flight, at most
+
+struct PB_uring_t;
+typedef struct PB_uring_t PB_uring_t;
+
+PB_uring_t *PB_uring_create(void);
+void PB_uring_destroy(PB_uring_t *ring);
+
+// Buffers for fixed reads, fixed_index is their position in iov.
+bool PB_uring_register_buffers(PB_uring_t *ring, const struct iovec *iov, unsigned count);
+
+// Queue one operation each, submitted by the next PB_uring_enter.
+// false when the submission queue stays full.
+bool PB_uring_read(PB_uring_t *ring, int fd, void *buffer, unsigned size, int fixed_index, uint64_t user_data);
+bool PB_uring_poll(PB_uring_t *ring, int fd, unsigned events, uint64_t user_data);
+bool PB_uring_cancel(PB_uring_t *ring, uint64_t target, uint64_t user_data);
+
+// One io_uring_enter: submits what is queued and waits up to timeout_ms
+// (negative: forever, 0: not at all) for a completion. -1 on error.
+int PB_uring_enter(PB_uring_t *ring, int timeout_ms);
+// Pops the next completion, false when there is none.
+bool PB_uring_complete(PB_uring_t *ring, uint64_t *user_data, int32_t *result);
+#endif
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_generic_functions.h"
+#include "process_bridge.h"
+
+typedef struct
+{
+    PB_process_t *process;
+    bool ready; // handshake line received (always true without one)
+} standby_t;
+
+// The standby children of one command, oldest first.
+typedef struct warm_set_t warm_set_t;
+struct warm_set_t
+{
+    char *command;
+    standby_t *standby;
+    size_t count;
+    warm_set_t *next;
+};
+
+struct PB_warm_t
+{
+    size_t standby;
+    char *ready_line; // NULL: ready as soon as spawned
+    int handshake_timeout_ms;
+    char *handshake; // mailbox for the ready line, one byte larger to catch longer lines
+    size_t handshake_size;
+    warm_set_t *sets;
+};
+
+static warm_set_t *get_set(PB_warm_t *warm, const char *command);
+static PB_process_t *spawn_one(const char *command);
+static PB_status_t check_ready(PB_warm_t *warm, standby_t *standby, int timeout_ms);
+static void discard(PB_process_t *process);
+static PB_process_t *take(warm_set_t *set, size_t index);
+static void top_up(PB_warm_t *warm, warm_set_t *set);
+
+//------------------------------------------------------------------------------
+
+PB_warm_t *PB_warm_create(size_t standby, const char *ready_line, int handshake_timeout_ms)
+{
+    if (0 == standby)
+    {
+        return NULL;
+    }
+
+    PB_warm_t *warm = (PB_warm_t *)malloc(sizeof(PB_warm_t));
+    if (NULL == warm)
+    {
+        return NULL;
+    }
+    warm->standby = standby;
+    warm->ready_line = NULL;
+    warm->handshake_timeout_ms = handshake_timeout_ms;
+    warm->handshake = NULL;
+    warm->handshake_size = 0;
+    warm->sets = NULL;
+    if (NULL != ready_line)
+    {
+        size_t length = strlen(ready_line);
+        warm->ready_line = PB_string_clone(ready_line, length);
+        warm->handshake_size = length + 2;
+        warm->handshake = (char *)malloc(warm->handshake_size);
+        if (NULL == warm->ready_line || NULL == warm->handshake)
+        {
+            PB_warm_destroy(warm);
+            return NULL;
+        }
+    }
+    return warm;
+}
+
+void PB_warm_destroy(PB_warm_t *warm)
+{
+    if (NULL == warm)
+    {
+        return;
+    }
+
+    while (NULL != warm->sets)
+    {
+        warm_set_t *set = warm->sets;
+        warm->sets = set->next;
+        for (size_t i = 0; i < set->count; i++)
+        {
+            discard(set->standby[i].process);
+        }
+        free(set->standby);
+        free(set->command);
+        free(set);
+    }
+    free(warm->ready_line);
+    free(warm->handshake);
+    free(warm);
+}
+
+PB_status_t PB_warm_prepare(PB_warm_t *warm, const char *command)
+{
+    if (NULL == warm || NULL == command)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    warm_set_t *set = get_set(warm, command);
+    if (NULL == set)
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    top_up(warm, set);
+    return 0 == set->count ? PB_STATUS_GENERIC_ERROR : PB_STATUS_OK;
+}
+
+PB_process_t *PB_acquire_warm(PB_warm_t *warm, const char *command)
+{
+    if (NULL == warm || NULL == command)
+    {
+        return NULL;
+    }
+
+    warm_set_t *set = get_set(warm, command);
+    if (NULL == set)
+    {
+        return NULL;
+    }
+
+    PB_process_t *process = NULL;
+    while (NULL == process && 0 != set->count)
+    {
+        // A child that already passed the handshake, without waiting.
+        for (size_t i = 0; i < set->count && NULL == process;)
+        {
+            PB_status_t status = check_ready(warm, &set->standby[i], 0);
+            if (PB_STATUS_OK == status)
+            {
+                process = take(set, i);
+            }
+            else if (PB_STATUS_TIMEOUT == status)
+            {
+                i++;
+            }
+            else
+            {
+                discard(take(set, i)); // died or said something else
+            }
+        }
+        // Otherwise the oldest one, which is the closest to ready. If it is
+        // stuck, the younger ones are not expected to do better.
+        if (NULL == process && 0 != set->count)
+        {
+            PB_status_t status = check_ready(warm, &set->standby[0], warm->handshake_timeout_ms);
+            if (PB_STATUS_OK == status)
+            {
+                process = take(set, 0);
+            }
+            else
+            {
+                discard(take(set, 0));
+            }
+            if (PB_STATUS_TIMEOUT == status)
+            {
+                break;
+            }
+        }
+    }
+
+    if (NULL == process)
+    {
+        // Cold start: nothing was prepared, or every standby child failed.
+        standby_t cold = {spawn_one(command), NULL == warm->ready_line};
+        if (NULL != cold.process && PB_STATUS_OK == check_ready(warm, &cold, warm->handshake_timeout_ms))
+        {
+            process = cold.process;
+        }
+        else
+        {
+            discard(cold.process);
+        }
+    }
+
+    top_up(warm, set);
+    return process;
+}
+
+size_t PB_warm_ready(PB_warm_t *warm, const char *command)
+{
+    if (NULL == warm || NULL == command)
+    {
+        return 0;
+    }
+
+    size_t ready = 0;
+    for (warm_set_t *set = warm->sets; NULL != set; set = set->next)
+    {
+        if (0 != strcmp(set->command, command))
+        {
+            continue;
+        }
+        for (size_t i = 0; i < set->count; i++)
+        {
+            if (PB_STATUS_OK == check_ready(warm, &set->standby[i], 0))
+            {
+                ready++;
+            }
+        }
+    }
+    return ready;
+}
+
+//------------------------------------------------------------------------------
+
+static warm_set_t *get_set(PB_warm_t *warm, const char *command)
+{
+    for (warm_set_t *set = warm->sets; NULL != set; set = set->next)
+    {
+        if (0 == strcmp(set->command, command))
+        {
+            return set;
+        }
+    }
+
+    warm_set_t *set = (warm_set_t *)malloc(sizeof(warm_set_t));
+    char *copy = PB_string_clone(command, strlen(command));
+    standby_t *standby = (standby_t *)calloc(warm->standby, sizeof(standby_t));
+    if (NULL == set || NULL == copy || NULL == standby)
+    {
+        free(set);
+        free(copy);
+        free(standby);
+        return NULL;
+    }
+    set->command = copy;
+    set->standby = standby;
+    set->count = 0;
+    set->next = warm->sets;
+    warm->sets = set;
+    return set;
+}
+
+static PB_process_t *spawn_one(const char *command)
+{
+    PB_process_t *process = PB_create(PB_TYPE_CHILD);
+    if (NULL != process && PB_STATUS_OK != PB_spawn(process, command))
+    {
+        PB_destroy(process);
+        return NULL;
+    }
+    return process;
+}
+
+// PB_STATUS_OK once the ready line was read, PB_STATUS_TIMEOUT while it is
+// still coming, anything else when the child cannot be used.
+static PB_status_t check_ready(PB_warm_t *warm, standby_t *standby, int timeout_ms)
+{
+    if (standby->ready)
+    {
+        return PB_STATUS_OK;
+    }
+
+    PB_status_t status = PB_receive_timeout(standby->process, warm->handshake, warm->handshake_size, timeout_ms);
+    if (PB_STATUS_OK != status)
+    {
+        return status;
+    }
+    if (0 != strcmp(warm->handshake, warm->ready_line))
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    standby->ready = true;
+    return PB_STATUS_OK;
+}
+
+static void discard(PB_process_t *process)
+{
+    if (NULL != process)
+    {
+        PB_despawn(process);
+        PB_wait(process);
+        PB_destroy(process);
+    }
+}
+
+// Removes the standby child at index, keeping the others in order.
+static PB_process_t *take(warm_set_t *set, size_t index)
+{
+    PB_process_t *process = set->standby[index].process;
+    set->count--;
+    memmove(&set->standby[index], &set->standby[index + 1], (set->count - index) * sizeof(standby_t));
+    return process;
+}
+
+// Spawns without waiting for the handshake, which proceeds in the children
+// while the caller works.
+static void top_up(PB_warm_t *warm, warm_set_t *set)
+{
+    while (set->count < warm->standby)
+    {
+        PB_process_t *process = spawn_one(set->command);
+        if (NULL == process)
+        {
+            return;
+        }
+        set->standby[set->count].process = process;
+        set->standby[set->count].ready = NULL == warm->ready_line;
+        set->count++;
+    }
+}
@@ -0,0 +1,601 @@
+#ifdef __linux__
+#define _GNU_SOURCE // SOCK_CLOEXEC
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PB_drain.h"
+#include "PB_generic_functions.h"
+#include "PB_internal.h"
+#include "PB_shm.h"
+#include "process_bridge.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define PB_ZYGOTE_ENVIRONMENT "PB_ZYGOTE"
+#define PB_ZYGOTE_CHILD_FD 3 // the control socket, in the zygote
+#define PB_ZYGOTE_FDS 3      // stdin, stdout and stderr of a new child
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Zygote to parent, over the control socket. Parent to zygote there is only
+// one byte per spawn, carrying the child's stdio ends.
+typedef enum
+{
+    ZYGOTE_SPAWNED, // value: 0 or the errno of fork()
+    ZYGOTE_EXITED,  // value: waitpid() status
+} zygote_message_kind_t;
+
+typedef struct
+{
+    int32_t kind;
+    int32_t pid;
+    int32_t value;
+} zygote_message_t;
+
+typedef struct
+{
+    pid_t pid;
+    int status;
+    bool abandoned; // not reported yet, and nobody will wait for it
+} exited_t;
+
+struct PB_zygote_t
+{
+    pid_t pid;
+    int control;
+    exited_t *exited; // reported before anybody waited for them, or abandoned
+    size_t exited_count;
+    size_t exited_capacity;
+};
+
+static int read_message(int fd, zygote_message_t *message);
+static int write_message(int fd, int32_t kind, int32_t pid, int32_t value);
+static int store_exited(PB_zygote_t *zygote, pid_t pid, int status, bool abandoned);
+static exited_t *find_exited(PB_zygote_t *zygote, pid_t pid);
+static int send_fds(int fd, const int fds[PB_ZYGOTE_FDS]);
+static int receive_fds(int fd, int fds[PB_ZYGOTE_FDS]);
+static void on_sigchld(int signal_number);
+static int fork_child(int control, const int fds[PB_ZYGOTE_FDS]);
+
+extern char **environ;
+static int sigchld_pipe[2] = {-1, -1};
+
+//------------------------------------------------------------------------------
+
+PB_zygote_t *PB_zygote_create(const char *command)
+{
+    if (NULL == command)
+    {
+        return NULL;
+    }
+
+    PB_zygote_t *zygote = (PB_zygote_t *)malloc(sizeof(PB_zygote_t));
+    if (NULL == zygote)
+    {
+        return NULL;
+    }
+    zygote->pid = -1;
+    zygote->control = -1;
+    zygote->exited = NULL;
+    zygote->exited_count = 0;
+    zygote->exited_capacity = 0;
+
+    char *program = NULL;
+    char **argv = NULL;
+    if (PB_extract_program(command, &program) || PB_extract_argv(command, &argv))
+    {
+        PB_free_program_and_argv(&program, &argv);
+        free(zygote);
+        return NULL;
+    }
+
+    int sockets[2];
+#ifdef SOCK_CLOEXEC
+    int socket_error = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets);
+#else
+    int socket_error = socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+    if (0 == socket_error)
+    {
+        fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+        fcntl(sockets[1], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    char entry[64];
+    snprintf(entry, sizeof(entry), PB_ZYGOTE_ENVIRONMENT "=%d", PB_ZYGOTE_CHILD_FD);
+    char **envp = 0 == socket_error ? PB_environment_with(entry) : NULL;
+    if (NULL == envp)
+    {
+        if (0 == socket_error)
+        {
+            close(sockets[0]);
+            close(sockets[1]);
+        }
+        PB_free_program_and_argv(&program, &argv);
+        free(zygote);
+        return NULL;
+    }
+
+    // The zygote's own stdio is not a message channel: it only keeps stderr.
+    // Its end of the socket must not already sit on the target fd, where
+    // dup2() would leave it close-on-exec.
+    int zygote_end = sockets[1];
+    if (PB_ZYGOTE_CHILD_FD == zygote_end)
+    {
+        zygote_end = fcntl(sockets[1], F_DUPFD_CLOEXEC, PB_ZYGOTE_CHILD_FD + 1);
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, zygote_end, PB_ZYGOTE_CHILD_FD);
+
+    int spawn_error = -1 == zygote_end ? errno : posix_spawnp(&zygote->pid, program, &actions, NULL, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    PB_free_program_and_argv(&program, &argv);
+    free(envp);
+    if (zygote_end != sockets[1] && -1 != zygote_end)
+    {
+        close(zygote_end);
+    }
+    close(sockets[1]);
+    if (spawn_error)
+    {
+        close(sockets[0]);
+        free(zygote);
+        return NULL;
+    }
+
+    zygote->control = sockets[0];
+    return zygote;
+}
+
+void PB_zygote_destroy(PB_zygote_t *zygote)
+{
+    if (NULL == zygote)
+    {
+        return;
+    }
+
+    // End of file on the control socket makes the zygote exit.
+    close(zygote->control);
+    int status;
+    while (-1 == waitpid(zygote->pid, &status, 0) && EINTR == errno)
+    {
+    }
+    free(zygote->exited);
+    free(zygote);
+}
+
+PB_status_t PB_spawn_from_zygote(PB_zygote_t *zygote, PB_process_t *child)
+{
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    if (NULL == zygote || PB_TYPE_CHILD != child->type)
+    {
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "PB_spawn_from_zygote needs a zygote and a child process.");
+        child->status = PB_STATUS_USAGE_ERROR;
+        return PB_STATUS_USAGE_ERROR;
+    }
+
+    int stdin_pipe[2];
+    int stdout_pipe[2];
+    int stderr_pipe[2];
+    bool stdin_pipe_error = PB_open_pipe(stdin_pipe, 0);
+    bool stdout_pipe_error = PB_open_pipe(stdout_pipe, 0);
+    bool stderr_pipe_error = PB_open_pipe(stderr_pipe, 0);
+    if (stdin_pipe_error || stdout_pipe_error || stderr_pipe_error)
+    {
+        PB_close_pipe(stdin_pipe);
+        PB_close_pipe(stdout_pipe);
+        PB_close_pipe(stderr_pipe);
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while creating pipes.");
+        child->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    // The zygote gets the child's ends, we keep ours.
+    const int child_ends[PB_ZYGOTE_FDS] = {stdin_pipe[0], stdout_pipe[1], stderr_pipe[1]};
+    int send_error = send_fds(zygote->control, child_ends);
+    close(stdin_pipe[0]);
+    close(stdout_pipe[1]);
+    close(stderr_pipe[1]);
+
+    // Exits reported in the meantime are kept for PB_wait.
+    zygote_message_t message = {ZYGOTE_EXITED, -1, 0};
+    while (0 == send_error && ZYGOTE_EXITED == message.kind)
+    {
+        send_error = read_message(zygote->control, &message) ||
+                     (ZYGOTE_EXITED == message.kind && store_exited(zygote, message.pid, message.value, false));
+    }
+    if (send_error || 0 != message.value)
+    {
+        close(stdin_pipe[1]);
+        close(stdout_pipe[0]);
+        close(stderr_pipe[0]);
+        snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Error while forking from the zygote: %s",
+                 send_error ? "zygote not responding" : strerror(message.value));
+        child->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    // No rings between a zygote's child and us.
+    PB_shm_destroy(child->shm);
+    child->shm = NULL;
+    child->transport = PB_TRANSPORT_PIPE;
+    child->pid = message.pid;
+    child->stdin_fd = stdin_pipe[1];
+    child->stdout_fd = stdout_pipe[0];
+    child->stderr_fd = stderr_pipe[0];
+    child->zygote = zygote;
+    if (-1 != child->pidfd)
+    {
+        close(child->pidfd);
+    }
+    child->pidfd = PB_open_pidfd(child->pid); // may miss an instant exit, only PB_exit_fd uses it
+    child->reaped = false;
+    PB_drain_stop(child->stderr_drain); // of a previous spawn
+    child->stderr_drain = NULL;
+
+    // On failure the child is not left running behind an error.
+    if ((child->nonblocking && PB_STATUS_OK != PB_set_nonblocking(child, true)) || PB_STATUS_OK != PB_drain_spawned(child))
+    {
+        char error[PB_STRING_SIZE_DEFAULT];
+        memcpy(error, child->error, PB_STRING_SIZE_DEFAULT);
+        PB_despawn(child);
+        memcpy(child->error, error, PB_STRING_SIZE_DEFAULT);
+        child->status = PB_STATUS_GENERIC_ERROR;
+        return PB_STATUS_GENERIC_ERROR;
+    }
+
+    PB_clear_string(child->error);
+    child->status = PB_STATUS_OK;
+    return PB_STATUS_OK;
+}
+
+PB_status_t PB_zygote_serve(void)
+{
+    const char *value = getenv(PB_ZYGOTE_ENVIRONMENT);
+    if (NULL == value)
+    {
+        return PB_STATUS_OK; // spawned normally, serve as the child itself
+    }
+    int control = atoi(value);
+    unsetenv(PB_ZYGOTE_ENVIRONMENT);
+    fcntl(control, F_SETFD, FD_CLOEXEC);
+
+    // SIGCHLD wakes the loop through a self-pipe to reap the children.
+    if (PB_open_pipe(sigchld_pipe, 0))
+    {
+        return PB_STATUS_GENERIC_ERROR;
+    }
+    fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_sigchld;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+
+    for (;;)
+    {
+        struct pollfd pfds[2] = {{control, POLLIN, 0}, {sigchld_pipe[0], POLLIN, 0}};
+        if (-1 == poll(pfds, 2, -1))
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            exit(EXIT_FAILURE);
+        }
+
+        if (pfds[1].revents)
+        {
+            char drain[64];
+            while (read(sigchld_pipe[0], drain, sizeof(drain)) > 0)
+            {
+            }
+            int status;
+            pid_t pid;
+            while (0 < (pid = waitpid(-1, &status, WNOHANG)))
+            {
+                write_message(control, ZYGOTE_EXITED, (int32_t)pid, status);
+            }
+        }
+
+        if (pfds[0].revents)
+        {
+            int fds[PB_ZYGOTE_FDS];
+            if (receive_fds(control, fds))
+            {
+                exit(EXIT_SUCCESS); // the parent is gone or destroyed us
+            }
+            if (0 == fork_child(control, fds))
+            {
+                return PB_STATUS_OK; // in the new child
+            }
+        }
+    }
+}
+
+PB_status_t PB_zygote_wait(PB_zygote_t *zygote, pid_t pid, int *status, int64_t deadline)
+{
+    for (;;)
+    {
+        exited_t *exited = find_exited(zygote, pid);
+        if (NULL != exited && !exited->abandoned)
+        {
+            *status = exited->status;
+            *exited = zygote->exited[--zygote->exited_count];
+            return PB_STATUS_OK;
+        }
+
+        if (PB_NO_DEADLINE != deadline)
+        {
+            int64_t remaining = deadline - PB_monotonic_ms();
+            struct pollfd pfd = {zygote->control, POLLIN, 0};
+            int ready = poll(&pfd, 1, remaining > 0 ? (remaining < INT_MAX ? (int)remaining : INT_MAX) : 0);
+            if (0 == ready)
+            {
+                return PB_STATUS_TIMEOUT;
+            }
+            if (-1 == ready)
+            {
+                continue; // EINTR
+            }
+        }
+
+        zygote_message_t message;
+        if (read_message(zygote->control, &message) ||
+            (ZYGOTE_EXITED == message.kind && store_exited(zygote, message.pid, message.value, false)))
+        {
+            return PB_STATUS_GENERIC_ERROR;
+        }
+    }
+}
+
+void PB_zygote_abandon(PB_zygote_t *zygote, pid_t pid)
+{
+    exited_t *exited = find_exited(zygote, pid);
+    if (NULL != exited)
+    {
+        *exited = zygote->exited[--zygote->exited_count]; // already reported
+    }
+    else
+    {
+        store_exited(zygote, pid, 0, true);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// In the zygote: 0 in the new child, 1 in the zygote.
+static int fork_child(int control, const int fds[PB_ZYGOTE_FDS])
+{
+    fflush(NULL); // or the child would write our buffered output again
+    pid_t pid = fork();
+    if (0 == pid)
+    {
+        signal(SIGCHLD, SIG_DFL);
+        close(control);
+        PB_close_pipe(sigchld_pipe);
+        for (int i = 0; i < PB_ZYGOTE_FDS; i++)
+        {
+            dup2(fds[i], i); // STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO
+        }
+        for (int i = 0; i < PB_ZYGOTE_FDS; i++)
+        {
+            if (fds[i] >= PB_ZYGOTE_FDS)
+            {
+                close(fds[i]);
+            }
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < PB_ZYGOTE_FDS; i++)
+    {
+        close(fds[i]);
+    }
+    write_message(control, ZYGOTE_SPAWNED, (int32_t)pid, -1 == pid ? errno : 0);
+    return 1;
+}
+
+static void on_sigchld(int signal_number)
+{
+    (void)signal_number;
+    int saved_errno = errno;
+    if (write(sigchld_pipe[1], "", 1))
+    {
+        // full pipe: a wake-up is already pending
+    }
+    errno = saved_errno;
+}
+
+static int read_message(int fd, zygote_message_t *message)
+{
+    char *destination = (char *)message;
+    size_t done = 0;
+    while (done < sizeof(*message))
+    {
+        ssize_t bytes_read = read(fd, destination + done, sizeof(*message) - done);
+        if (0 == bytes_read || (-1 == bytes_read && EINTR != errno))
+        {
+            return 1;
+        }
+        done += bytes_read > 0 ? (size_t)bytes_read : 0;
+    }
+    return 0;
+}
+
+static int write_message(int fd, int32_t kind, int32_t pid, int32_t value)
+{
+    zygote_message_t message = {kind, pid, value};
+    const char *source = (const char *)&message;
+    size_t done = 0;
+    while (done < sizeof(message))
+    {
+        ssize_t written = send(fd, source + done, sizeof(message) - done, MSG_NOSIGNAL);
+        if (-1 == written && EINTR != errno)
+        {
+            return 1;
+        }
+        done += written > 0 ? (size_t)written : 0;
+    }
+    return 0;
+}
+
+// An abandoned pid only waits for its report, which is then dropped.
+static int store_exited(PB_zygote_t *zygote, pid_t pid, int status, bool abandoned)
+{
+    exited_t *exited = abandoned ? NULL : find_exited(zygote, pid);
+    if (NULL != exited && exited->abandoned)
+    {
+        *exited = zygote->exited[--zygote->exited_count];
+        return 0;
+    }
+
+    if (zygote->exited_count == zygote->exited_capacity)
+    {
+        size_t capacity = 0 == zygote->exited_capacity ? 16 : 2 * zygote->exited_capacity;
+        exited_t *exited = (exited_t *)realloc(zygote->exited, capacity * sizeof(exited_t));
+        if (NULL == exited)
+        {
+            return 1;
+        }
+        zygote->exited = exited;
+        zygote->exited_capacity = capacity;
+    }
+    zygote->exited[zygote->exited_count].pid = pid;
+    zygote->exited[zygote->exited_count].status = status;
+    zygote->exited[zygote->exited_count].abandoned = abandoned;
+    zygote->exited_count++;
+    return 0;
+}
+
+static exited_t *find_exited(PB_zygote_t *zygote, pid_t pid)
+{
+    for (size_t i = 0; i < zygote->exited_count; i++)
+    {
+        if (pid == zygote->exited[i].pid)
+        {
+            return &zygote->exited[i];
+        }
+    }
+    return NULL;
+}
+
+// One byte carrying the descriptors as SCM_RIGHTS.
+static int send_fds(int fd, const int fds[PB_ZYGOTE_FDS])
+{
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union
+    {
+        char buffer[CMSG_SPACE(PB_ZYGOTE_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(PB_ZYGOTE_FDS * sizeof(int));
+    memcpy(CMSG_DATA(header), fds, PB_ZYGOTE_FDS * sizeof(int));
+
+    ssize_t sent;
+    while (-1 == (sent = sendmsg(fd, &message, MSG_NOSIGNAL)) && EINTR == errno)
+    {
+    }
+    return 1 == sent ? 0 : 1;
+}
+
+static int receive_fds(int fd, int fds[PB_ZYGOTE_FDS])
+{
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union
+    {
+        char buffer[CMSG_SPACE(PB_ZYGOTE_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+#ifdef MSG_CMSG_CLOEXEC
+    while (-1 == (received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC)) && EINTR == errno)
+#else
+    while (-1 == (received = recvmsg(fd, &message, 0)) && EINTR == errno)
+#endif
+    {
+    }
+    struct cmsghdr *header = 1 == received ? CMSG_FIRSTHDR(&message) : NULL;
+    if (NULL == header || SOL_SOCKET != header->cmsg_level || SCM_RIGHTS != header->cmsg_type ||
+        CMSG_LEN(PB_ZYGOTE_FDS * sizeof(int)) != header->cmsg_len)
+    {
+        return 1;
+    }
+    memcpy(fds, CMSG_DATA(header), PB_ZYGOTE_FDS * sizeof(int));
+    return 0;
+}
+
+#else // _WIN32: no fork()
+
+PB_zygote_t *PB_zygote_create(const char *command)
+{
+    (void)command;
+    return NULL;
+}
+
+void PB_zygote_destroy(PB_zygote_t *zygote)
+{
+    (void)zygote;
+}
+
+PB_status_t PB_spawn_from_zygote(PB_zygote_t *zygote, PB_process_t *child)
+{
+    (void)zygote;
+    if (NULL == child)
+    {
+        return PB_STATUS_USAGE_ERROR;
+    }
+    snprintf(child->error, PB_STRING_SIZE_DEFAULT, "Zygotes are not supported on Windows.");
+    child->status = PB_STATUS_USAGE_ERROR;
+    return PB_STATUS_USAGE_ERROR;
+}
+
+PB_status_t PB_zygote_serve(void)
+{
+    return PB_STATUS_OK;
+}
+
+#endif
@@ -18,8 +18,164 @@ void sleep_for_one_second()
 #endif
 }
 
-int main()
+static int echo(PB_flush_policy_t policy, const char *ready_line)
 {
+    static char line[65536];
+    PB_process_t *parent = PB_create(PB_TYPE_PARENT);
+    PB_set_flush_policy(parent, policy);
+    if (NULL != ready_line)
+    {
+        PB_send(parent, ready_line);
+    }
+
+    while (PB_STATUS_OK == PB_receive(parent, line, sizeof(line)))
+    {
+        if (0 == strcmp(line, "exit"))
+        {
+            break;
+        }
+        PB_send(parent, line);
+    }
+
+    PB_destroy(parent);
+    return 0;
+}
+
+static int echo_framed(void)
+{
+    static char frame[65536];
+    size_t length = 0;
+    PB_process_t *parent = PB_create_framed(PB_TYPE_PARENT, PB_FRAMING_LENGTH_PREFIXED);
+
+    while (PB_STATUS_OK == PB_receive_bytes(parent, frame, sizeof(frame), &length))
+    {
+        if (4 == length && 0 == memcmp(frame, "exit", 4))
+        {
+            break;
+        }
+        PB_send_bytes(parent, frame, length);
+    }
+
+    PB_destroy(parent);
+    return 0;
+}
+
+// Writes half a line, and the rest once told to.
+static int half_line(void)
+{
+    char line[16];
+    PB_process_t *parent = PB_create(PB_TYPE_PARENT);
+    fputs("first ", stdout);
+    fflush(stdout);
+    PB_receive(parent, line, sizeof(line));
+    fputs("half\n", stdout);
+    fflush(stdout);
+    PB_destroy(parent);
+    return 0;
+}
+
+// Floods stderr well past a pipe's capacity before saying "done" on stdout.
+static int flood_stderr(void)
+{
+    char line[200];
+    PB_process_t *parent = PB_create(PB_TYPE_PARENT);
+    for (int i = 0; i < 2000; i++)
+    {
+        snprintf(line, sizeof(line), "log line %d %0150d", i, 0);
+        PB_send_err(parent, line);
+    }
+    PB_send(parent, "done");
+    PB_destroy(parent);
+    return 0;
+}
+
+// Answers tagged requests two at a time, the second one first.
+static int echo_tagged(void)
+{
+    static char lines[2][65536];
+    uint64_t ids[2];
+    size_t lengths[2];
+    PB_process_t *parent = PB_create(PB_TYPE_PARENT);
+
+    while (PB_STATUS_OK == PB_receive_tagged(parent, &ids[0], lines[0], sizeof(lines[0]), &lengths[0]) &&
+           0 != strcmp(lines[0], "exit") &&
+           PB_STATUS_OK == PB_receive_tagged(parent, &ids[1], lines[1], sizeof(lines[1]), &lengths[1]))
+    {
+        PB_send_tagged(parent, ids[1], lines[1], lengths[1]);
+        PB_send_tagged(parent, ids[0], lines[0], lengths[0]);
+    }
+
+    PB_destroy(parent);
+    return 0;
+}
+
+// Says "ready", then answers tagged requests until one says "crash".
+static int serve(void)
+{
+    static char line[65536];
+    uint64_t id;
+    size_t length;
+    PB_process_t *parent = PB_create(PB_TYPE_PARENT);
+    PB_send(parent, "ready");
+
+    while (PB_STATUS_OK == PB_receive_tagged(parent, &id, line, sizeof(line), &length))
+    {
+        if (0 == strcmp(line, "crash"))
+        {
+            return 3;
+        }
+        PB_send_tagged(parent, id, line, length);
+    }
+
+    PB_destroy(parent);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && 0 == strcmp(argv[1], "echo"))
+    {
+        return echo(PB_FLUSH_IMMEDIATE, NULL);
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "echo_coalesced"))
+    {
+        return echo(PB_FLUSH_COALESCE, NULL);
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "echo_ready"))
+    {
+        return echo(PB_FLUSH_IMMEDIATE, "ready");
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "echo_zygote"))
+    {
+        PB_zygote_serve();
+        return echo(PB_FLUSH_IMMEDIATE, NULL);
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "half_line"))
+    {
+        return half_line();
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "flood_stderr"))
+    {
+        return flood_stderr();
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "flood_stderr_zygote"))
+    {
+        PB_zygote_serve();
+        return flood_stderr();
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "serve"))
+    {
+        return serve();
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "echo_framed"))
+    {
+        return echo_framed();
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "echo_tagged"))
+    {
+        return echo_tagged();
+    }
+
     PB_process_t *parent = PB_create(PB_TYPE_PARENT);
     char buf[PB_STRING_SIZE_DEFAULT];
 
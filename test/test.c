@@ -1,9 +1,205 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
 #include <process_bridge.h>
 
+#ifdef __linux__
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+
+// Descriptors this process has open right now.
+static int count_open_fds(void)
+{
+    int count = 0;
+    DIR *directory = opendir("/proc/self/fd");
+    while (NULL != directory && NULL != readdir(directory))
+    {
+        count++;
+    }
+    if (NULL != directory)
+    {
+        closedir(directory);
+    }
+    return count;
+}
+
+// True once at most limit descriptors are open: the background reaper may
+// still hold the pidfds of children it has not collected yet.
+static bool fds_settle(int limit)
+{
+    for (int attempt = 0; attempt < 200; attempt++)
+    {
+        if (count_open_fds() <= limit)
+        {
+            return true;
+        }
+        poll(NULL, 0, 10);
+    }
+    return false;
+}
+
+// True once every pid is gone from /proc, i.e. reaped (zombies stay listed).
+static bool all_reaped(const pid_t *pids, size_t count)
+{
+    for (int attempt = 0; attempt < 200; attempt++)
+    {
+        size_t alive = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "/proc/%d", (int)pids[i]);
+            alive += 0 == access(path, F_OK);
+        }
+        if (0 == alive)
+        {
+            return true;
+        }
+        poll(NULL, 0, 10);
+    }
+    return false;
+}
+
+static void count_echo(PB_loop_t *loop, PB_process_t *process, PB_event_t event, const char *data, size_t length, void *user_data)
+{
+    (void)process;
+    (void)length;
+    int *received = (int *)user_data;
+    if (PB_EVENT_MESSAGE == event && 0 == strcmp(data, "loop"))
+    {
+        (*received)++;
+    }
+    if (PB_EVENT_CLOSED == event)
+    {
+        PB_loop_remove(loop, process);
+    }
+}
+
+typedef struct
+{
+    int sent;
+    int received;
+    int terminated;
+    char last[32];
+} async_state_t;
+
+static void count_async(PB_process_t *process, PB_status_t status, const char *data, size_t length, void *user_data)
+{
+    (void)process;
+    (void)length;
+    async_state_t *state = (async_state_t *)user_data;
+    if (PB_STATUS_OK != status)
+    {
+        state->terminated++;
+    }
+    else if (NULL == data)
+    {
+        state->sent++;
+    }
+    else
+    {
+        state->received++;
+        snprintf(state->last, sizeof(state->last), "%s", data);
+    }
+}
+
+static void despawn_async(PB_process_t *process, PB_status_t status, const char *data, size_t length, void *user_data)
+{
+    count_async(process, status, data, length, user_data);
+    if (PB_STATUS_OK == status)
+    {
+        PB_despawn(process);
+    }
+}
+
+static void count_pool_response(PB_pool_t *pool, PB_status_t status, const char *response, size_t length, void *user_data)
+{
+    (void)pool;
+    (void)length;
+    int *received = (int *)user_data;
+    if (PB_STATUS_OK == status && 0 == strncmp(response, "job", 3))
+    {
+        (*received)++;
+    }
+}
+
+static void count_pool_failure(PB_pool_t *pool, PB_status_t status, const char *response, size_t length, void *user_data)
+{
+    (void)pool;
+    (void)response;
+    (void)length;
+    int *failed = (int *)user_data;
+    if (PB_STATUS_TERMINATED == status)
+    {
+        (*failed)++;
+    }
+}
+#endif
+
+// user_data points at the index of the request, set to -1 once answered.
+static void check_response(PB_process_t *process, PB_status_t status, const char *response, size_t length, void *user_data)
+{
+    (void)process;
+    int *index = (int *)user_data;
+    char expected[32];
+    snprintf(expected, sizeof(expected), "req%d", *index);
+    if (PB_STATUS_OK == status && strlen(expected) == length && 0 == memcmp(response, expected, length))
+    {
+        *index = -1;
+    }
+}
+
+// Counts the requests a crashed child handed back, remembering the last one.
+typedef struct
+{
+    int count;
+    char last[32];
+} handback_t;
+
+static void collect_handback(PB_supervisor_t *supervisor, const char *request, size_t length, PB_response_callback_t callback, void *request_user_data, void *user_data)
+{
+    (void)supervisor;
+    (void)callback;
+    (void)request_user_data;
+    handback_t *handback = (handback_t *)user_data;
+    handback->count++;
+    snprintf(handback->last, sizeof(handback->last), "%.*s", (int)length, request);
+}
+
+#ifndef _WIN32
+#include <pthread.h>
+
+enum { CALLING_THREADS = 4, CALLS_PER_THREAD = 200 };
+
+typedef struct
+{
+    PB_threaded_t *threaded;
+    int thread_index;
+    int answered;
+} caller_t;
+
+// Each thread checks that it gets its own responses back.
+static void *call_many(void *argument)
+{
+    caller_t *caller = (caller_t *)argument;
+    char request[32];
+    char response[32];
+    size_t length = 0;
+    for (int i = 0; i < CALLS_PER_THREAD; i++)
+    {
+        int request_length = snprintf(request, sizeof(request), "t%d-%d", caller->thread_index, i);
+        if (PB_STATUS_OK == PB_threaded_call(caller->threaded, request, (size_t)request_length, response, sizeof(response), &length) &&
+            (size_t)request_length == length && 0 == memcmp(request, response, length))
+        {
+            caller->answered++;
+        }
+    }
+    return NULL;
+}
+#endif
+
 int main()
 {
     bool success = true;
@@ -15,8 +211,25 @@ int main()
 
 #ifdef _WIN32
     const char CHILD_COMMAND[] = "../bin/test_process_bridge_child.exe";
+    const char ECHO_COMMAND[] = "../bin/test_process_bridge_child.exe echo";
+    const char ECHO_FRAMED_COMMAND[] = "../bin/test_process_bridge_child.exe echo_framed";
+    const char ECHO_TAGGED_COMMAND[] = "../bin/test_process_bridge_child.exe echo_tagged";
+    const char ECHO_COALESCED_COMMAND[] = "../bin/test_process_bridge_child.exe echo_coalesced";
+    const char ECHO_READY_COMMAND[] = "../bin/test_process_bridge_child.exe echo_ready";
+    const char SERVE_COMMAND[] = "../bin/test_process_bridge_child.exe serve";
+    const char HALF_LINE_COMMAND[] = "../bin/test_process_bridge_child.exe half_line";
 #else
     const char CHILD_COMMAND[] = "../bin/test_process_bridge_child";
+    const char ECHO_COMMAND[] = "../bin/test_process_bridge_child echo";
+    const char ECHO_FRAMED_COMMAND[] = "../bin/test_process_bridge_child echo_framed";
+    const char ECHO_TAGGED_COMMAND[] = "../bin/test_process_bridge_child echo_tagged";
+    const char ECHO_COALESCED_COMMAND[] = "../bin/test_process_bridge_child echo_coalesced";
+    const char ECHO_READY_COMMAND[] = "../bin/test_process_bridge_child echo_ready";
+    const char ECHO_ZYGOTE_COMMAND[] = "../bin/test_process_bridge_child echo_zygote";
+    const char FLOOD_STDERR_COMMAND[] = "../bin/test_process_bridge_child flood_stderr";
+    const char FLOOD_STDERR_ZYGOTE_COMMAND[] = "../bin/test_process_bridge_child flood_stderr_zygote";
+    const char SERVE_COMMAND[] = "../bin/test_process_bridge_child serve";
+    const char HALF_LINE_COMMAND[] = "../bin/test_process_bridge_child half_line";
 #endif
 
     PB_spawn(child, CHILD_COMMAND);
@@ -106,6 +319,826 @@ int main()
 
     //--------------------------------------------------------------------------
 
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+
+    PB_spawn(child, ECHO_COMMAND);
+
+    char long_message[151];
+    memset(long_message, 'x', 150);
+    long_message[150] = '\0';
+    char long_mailbox[200];
+
+    PB_send(child, long_message);
+    PB_send(child, long_message);
+    PB_receive(child, long_mailbox, sizeof(long_mailbox));
+    if (strcmp(long_mailbox, long_message))
+    {
+        PB_send(user, "ERROR: long message not received whole");
+        success = false;
+    }
+
+    PB_receive(child, long_mailbox, 101);
+    if (100 != strlen(long_mailbox))
+    {
+        PB_send(user, "ERROR: long message not split at mailbox size");
+        success = false;
+    }
+    PB_receive(child, long_mailbox, 101);
+    if (50 != strlen(long_mailbox))
+    {
+        PB_send(user, "ERROR: rest of long message not received");
+        success = false;
+    }
+
+    char huge_message[1001];
+    char huge_mailbox[2000];
+    memset(huge_message, 'y', 1000);
+    huge_message[1000] = '\0';
+    PB_send(child, huge_message);
+    PB_receive(child, huge_mailbox, sizeof(huge_mailbox));
+    if (strcmp(huge_mailbox, huge_message))
+    {
+        PB_send(user, "ERROR: message longer than PB_STRING_SIZE_DEFAULT not echoed whole");
+        success = false;
+    }
+
+    enum { BATCH_COUNT = 1000 };
+    static char batch_storage[BATCH_COUNT][16];
+    const char *batch[BATCH_COUNT];
+    for (int i = 0; i < BATCH_COUNT; i++)
+    {
+        snprintf(batch_storage[i], sizeof(batch_storage[i]), "b%d", i);
+        batch[i] = batch_storage[i];
+    }
+    PB_send_batch(child, batch, BATCH_COUNT);
+    for (int i = 0; i < BATCH_COUNT; i++)
+    {
+        PB_receive(child, buf_in, sizeof(buf_in));
+        if (strcmp(buf_in, batch[i]))
+        {
+            PB_send(user, "ERROR: batch not echoed in order");
+            success = false;
+            break;
+        }
+    }
+
+    if (PB_STATUS_TIMEOUT != PB_receive_timeout(child, buf_in, sizeof(buf_in), 50))
+    {
+        PB_send(user, "ERROR: PB_receive_timeout did not time out");
+        success = false;
+    }
+    PB_send(child, "after timeout");
+    if (PB_STATUS_OK != PB_receive_timeout(child, buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, "after timeout"))
+    {
+        PB_send(user, "ERROR: PB_receive_timeout did not receive after a timeout");
+        success = false;
+    }
+
+    // Half a line read before a timeout is kept for the next receive.
+    PB_process_t *half_child = PB_create(PB_TYPE_CHILD);
+    PB_spawn(half_child, HALF_LINE_COMMAND);
+    if (PB_STATUS_TIMEOUT != PB_receive_timeout(half_child, buf_in, sizeof(buf_in), 200))
+    {
+        PB_send(user, "ERROR: PB_receive_timeout returned half a line");
+        success = false;
+    }
+    PB_send(half_child, "finish");
+    if (PB_STATUS_OK != PB_receive_timeout(half_child, buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, "first half"))
+    {
+        PB_send(user, "ERROR: half a line lost after a timeout");
+        success = false;
+    }
+    PB_wait(half_child);
+    PB_destroy(half_child);
+
+    PB_send_batch(child, batch, 3);
+    PB_message_view_t views[8];
+    size_t view_count = 0;
+    size_t views_seen = 0;
+    while (views_seen < 3 && PB_STATUS_OK == PB_receive_many(child, views, 8, &view_count))
+    {
+        for (size_t i = 0; i < view_count; i++, views_seen++)
+        {
+            if (strcmp(views[i].data, batch[views_seen]) || strlen(batch[views_seen]) != views[i].length)
+            {
+                PB_send(user, "ERROR: PB_receive_many views not as expected");
+                success = false;
+            }
+        }
+    }
+    if (3 != views_seen)
+    {
+        PB_send(user, "ERROR: PB_receive_many missed messages");
+        success = false;
+    }
+
+    PB_send(child, "exit");
+    PB_wait(child);
+
+    //--------------------------------------------------------------------------
+
+#ifndef _WIN32
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_set_nonblocking(child, true);
+
+    PB_spawn(child, ECHO_COMMAND);
+
+    if (PB_STATUS_WOULD_BLOCK != PB_try_receive(child, buf_in, sizeof(buf_in)))
+    {
+        PB_send(user, "ERROR: PB_try_receive did not report an empty pipe");
+        success = false;
+    }
+
+    // Far more than both pipes can hold: sends must queue instead of blocking.
+    enum { BURST_COUNT = 20000 };
+    bool queued = false;
+    for (int i = 0; i < BURST_COUNT; i++)
+    {
+        snprintf(buf_out, sizeof(buf_out), "burst-%05d", i);
+        queued |= PB_STATUS_WOULD_BLOCK == PB_try_send(child, buf_out);
+    }
+    if (!queued)
+    {
+        PB_send(user, "ERROR: PB_try_send never queued");
+        success = false;
+    }
+
+    int burst_received = 0;
+    while (burst_received < BURST_COUNT)
+    {
+        PB_status_t flush_status = PB_flush(child);
+        PB_status_t status = PB_try_receive(child, buf_in, sizeof(buf_in));
+        if (PB_STATUS_OK == status)
+        {
+            snprintf(buf_out, sizeof(buf_out), "burst-%05d", burst_received);
+            if (strcmp(buf_in, buf_out))
+            {
+                PB_send(user, "ERROR: non-blocking burst not echoed in order");
+                success = false;
+                break;
+            }
+            burst_received++;
+        }
+        else if (PB_STATUS_WOULD_BLOCK != status || (PB_STATUS_OK != flush_status && PB_STATUS_WOULD_BLOCK != flush_status))
+        {
+            PB_send(user, "ERROR: non-blocking burst failed");
+            success = false;
+            break;
+        }
+    }
+
+    PB_send(child, "exit");
+    PB_wait(child);
+#endif
+
+#ifndef _WIN32
+    // A program without a slash is searched in PATH.
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    if (PB_STATUS_OK != PB_spawn(child, "echo found in path") ||
+        PB_STATUS_OK != PB_receive_timeout(child, buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, "found in path"))
+    {
+        PB_send(user, "ERROR: program not found in PATH");
+        success = false;
+    }
+    PB_wait(child);
+
+    // Both sides coalesce: the receives flush what each one owes the other.
+    enum { COALESCED = 100 };
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_set_flush_policy(child, PB_FLUSH_COALESCE);
+    PB_spawn(child, ECHO_COALESCED_COMMAND);
+    for (int i = 0; i < COALESCED; i++)
+    {
+        snprintf(buf_out, sizeof(buf_out), "coalesced%d", i);
+        PB_send(child, buf_out);
+    }
+    for (int i = 0; i < COALESCED; i++)
+    {
+        snprintf(buf_out, sizeof(buf_out), "coalesced%d", i);
+        if (PB_STATUS_OK != PB_receive_timeout(child, buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, buf_out))
+        {
+            PB_send(user, "ERROR: coalesced messages not flushed by the receive");
+            success = false;
+            break;
+        }
+    }
+    PB_send(child, "exit");
+    PB_flush(child);
+    PB_wait(child);
+    // Still queued once the reader is gone: PB_destroy drops it, without SIGPIPE.
+    PB_send(child, "nobody reads this");
+
+    // Raw file content and raw pages, both already newline-terminated lines.
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_spawn(child, ECHO_COMMAND);
+
+    FILE *input = tmpfile();
+    fputs("skipped\nfile line 1\nfile line 2\n", input);
+    fflush(input);
+    if (PB_STATUS_OK != PB_send_file(child, fileno(input), 8, 24))
+    {
+        PB_send(user, "ERROR: PB_send_file failed");
+        success = false;
+    }
+    fclose(input);
+    for (int i = 1; i <= 2; i++)
+    {
+        snprintf(buf_out, sizeof(buf_out), "file line %d", i);
+        if (PB_STATUS_OK != PB_receive_timeout(child, buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, buf_out))
+        {
+            PB_send(user, "ERROR: PB_send_file content not echoed");
+            success = false;
+            break;
+        }
+    }
+
+    enum { PAGE = 4096 };
+    char *page = (char *)aligned_alloc(PAGE, PAGE);
+    memset(page, 'p', PAGE - 1);
+    page[PAGE - 1] = '\n';
+    if (PB_STATUS_OK != PB_send_pages(child, page, PAGE))
+    {
+        PB_send(user, "ERROR: PB_send_pages failed");
+        success = false;
+    }
+    static char page_mailbox[PAGE];
+    PB_receive_timeout(child, page_mailbox, sizeof(page_mailbox), 5000);
+    if (PAGE - 1 != strlen(page_mailbox) || memcmp(page_mailbox, page, PAGE - 1))
+    {
+        PB_send(user, "ERROR: PB_send_pages content not echoed");
+        success = false;
+    }
+    free(page); // only once the child has read it
+
+    PB_send(child, "exit");
+    PB_wait(child);
+#endif
+
+#ifdef __linux__
+    enum { LOOP_CHILDREN = 4 };
+    // Same traffic over epoll and io_uring, which may fall back to epoll.
+    for (int backend = PB_LOOP_BACKEND_EPOLL; backend <= PB_LOOP_BACKEND_IO_URING; backend++)
+    {
+        PB_loop_t *loop = PB_loop_create_backend((PB_loop_backend_t)backend);
+        PB_process_t *loop_children[LOOP_CHILDREN];
+        int loop_received = 0;
+        for (int i = 0; i < LOOP_CHILDREN; i++)
+        {
+            loop_children[i] = PB_create(PB_TYPE_CHILD);
+            if (i % 2)
+            {
+                PB_set_transport(loop_children[i], PB_TRANSPORT_SHARED_MEMORY);
+            }
+            PB_spawn(loop_children[i], ECHO_COMMAND);
+            PB_loop_add(loop, loop_children[i], count_echo, &loop_received);
+            PB_try_send(loop_children[i], "loop");
+            PB_try_send(loop_children[i], "loop");
+        }
+        // The ring owns the pipes, a read of our own would race it.
+        if (PB_LOOP_BACKEND_IO_URING == PB_loop_backend(loop) && PB_STATUS_USAGE_ERROR != PB_receive_timeout(loop_children[0], buf_in, sizeof(buf_in), 100))
+        {
+            PB_send(user, "ERROR: PB_receive_timeout read a pipe owned by an io_uring loop");
+            success = false;
+        }
+        while (loop_received < 2 * LOOP_CHILDREN)
+        {
+            if (PB_STATUS_OK != PB_loop_run_once(loop, 5000))
+            {
+                PB_send(user, "ERROR: PB_loop_run_once did not dispatch");
+                success = false;
+                break;
+            }
+        }
+        for (int i = 0; i < LOOP_CHILDREN; i++)
+        {
+            PB_try_send(loop_children[i], "exit");
+        }
+        PB_loop_run(loop); // returns once every child closed its stdout
+        for (int i = 0; i < LOOP_CHILDREN; i++)
+        {
+            PB_wait(loop_children[i]);
+            PB_destroy(loop_children[i]);
+        }
+        PB_loop_destroy(loop);
+    }
+
+    // Async operations complete through one pollable fd.
+    PB_process_t *async_child = PB_create(PB_TYPE_CHILD);
+    PB_spawn(async_child, ECHO_COMMAND);
+    async_state_t async_state = {0};
+    const char *async_messages[] = {"async one", "async two", "async three"};
+    for (int i = 0; i < 3; i++)
+    {
+        PB_receive_async(async_child, count_async, &async_state);
+        PB_send_async(async_child, async_messages[i], strlen(async_messages[i]), count_async, &async_state);
+    }
+    struct pollfd async_poll = {.fd = PB_async_fd(async_child), .events = POLLIN};
+    while (async_state.received < 3 && 1 == poll(&async_poll, 1, 5000))
+    {
+        PB_async_dispatch(async_child);
+    }
+    if (3 != async_state.sent || 3 != async_state.received || 0 != strcmp(async_state.last, "async three"))
+    {
+        PB_send(user, "ERROR: PB_send_async/PB_receive_async did not complete");
+        success = false;
+    }
+    PB_receive_async(async_child, count_async, &async_state);
+    PB_despawn(async_child); // cancels the pending receive
+    if (1 != async_state.terminated || 0 != PB_async_pending(async_child))
+    {
+        PB_send(user, "ERROR: PB_despawn did not cancel the async receive");
+        success = false;
+    }
+    PB_wait(async_child);
+    PB_destroy(async_child);
+
+    // Despawned from a callback while the dispatch has more to hand out.
+    async_child = PB_create(PB_TYPE_CHILD);
+    PB_spawn(async_child, ECHO_COMMAND);
+    async_state = (async_state_t){0};
+    PB_receive_async(async_child, despawn_async, &async_state);
+    PB_receive_async(async_child, despawn_async, &async_state);
+    PB_send(async_child, "first");
+    PB_send(async_child, "second");
+    async_poll.fd = PB_async_fd(async_child);
+    while (0 == async_state.received && 1 == poll(&async_poll, 1, 5000))
+    {
+        PB_async_dispatch(async_child);
+    }
+    if (1 != async_state.received || 1 != async_state.terminated || 0 != strcmp(async_state.last, "first"))
+    {
+        PB_send(user, "ERROR: despawn from an async callback did not cancel the rest");
+        success = false;
+    }
+    PB_wait(async_child);
+    PB_destroy(async_child);
+
+    enum { POOL_JOBS = 100 };
+    PB_pool_t *pool = PB_pool_create(ECHO_COMMAND, 4);
+    int pool_received = 0;
+    for (int i = 0; i < POOL_JOBS; i++)
+    {
+        snprintf(buf_out, sizeof(buf_out), "job%d", i);
+        PB_pool_submit(pool, buf_out, count_pool_response, &pool_received);
+    }
+    PB_pool_wait(pool);
+    if (POOL_JOBS != pool_received || 0 != PB_pool_outstanding(pool))
+    {
+        PB_send(user, "ERROR: PB_pool did not answer every job");
+        success = false;
+    }
+    PB_pool_destroy(pool);
+
+    // The only worker is killed mid-request: that request and the one queued
+    // behind it fail, and the empty pool refuses new ones.
+    // Its pipes are closed, however many such pools come and go.
+    int fds_before = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        int pool_failed = 0;
+        pool = PB_pool_create("sh -c \"read line; kill -KILL $$\"", 1);
+        PB_pool_submit(pool, "job0", count_pool_failure, &pool_failed);
+        PB_pool_submit(pool, "job1", count_pool_failure, &pool_failed);
+        PB_pool_wait(pool);
+        if (2 != pool_failed || PB_STATUS_TERMINATED != PB_pool_submit(pool, "job2", count_pool_failure, &pool_failed) ||
+            0 != PB_pool_outstanding(pool))
+        {
+            PB_send(user, "ERROR: PB_pool did not fail the requests of a killed worker");
+            success = false;
+        }
+        PB_pool_destroy(pool);
+        if (0 == i)
+        {
+            fds_before = count_open_fds(); // the reaper's own ones included
+        }
+    }
+    if (!fds_settle(fds_before))
+    {
+        PB_send(user, "ERROR: PB_pool leaked the pipes of a killed worker");
+        success = false;
+    }
+
+    // Despawned children are reaped without anybody calling PB_wait.
+    enum { DESPAWNED = 20 };
+    pid_t despawned[DESPAWNED];
+    for (int i = 0; i < DESPAWNED; i++)
+    {
+        PB_process_t *victim = PB_create(PB_TYPE_CHILD);
+        PB_spawn(victim, ECHO_COMMAND);
+        despawned[i] = victim->pid;
+        PB_despawn(victim);
+        PB_destroy(victim);
+    }
+    if (!all_reaped(despawned, DESPAWNED))
+    {
+        PB_send(user, "ERROR: despawned children left as zombies");
+        success = false;
+    }
+
+    // Killing a child that outlives its pipes leaves no timeout behind.
+    PB_process_t *sleeper = PB_create(PB_TYPE_CHILD);
+    PB_spawn(sleeper, "sleep 5");
+    if (PB_STATUS_OK != PB_despawn(sleeper) || PB_STATUS_TIMEOUT == sleeper->status || 0 != strlen(sleeper->error))
+    {
+        PB_send(user, "ERROR: PB_despawn left the status of its exit probe");
+        success = false;
+    }
+    PB_destroy(sleeper);
+
+    // Larger pipes than the default.
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_spawn_options_t options = {.stdin_pipe_size = 262144, .stdout_pipe_size = 262144};
+    if (PB_STATUS_OK != PB_spawn_with_options(child, ECHO_COMMAND, &options))
+    {
+        PB_send(user, "ERROR: PB_spawn_with_options failed");
+        success = false;
+    }
+    PB_send(child, huge_message);
+    PB_receive(child, huge_mailbox, sizeof(huge_mailbox));
+    if (strcmp(huge_mailbox, huge_message))
+    {
+        PB_send(user, "ERROR: message not echoed through resized pipes");
+        success = false;
+    }
+    PB_send(child, "exit");
+    PB_wait(child);
+
+    // Same echo child, messages through the shared memory rings.
+    enum { SHM_MESSAGES = 500 };
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_set_transport(child, PB_TRANSPORT_SHARED_MEMORY);
+    PB_spawn(child, ECHO_COMMAND);
+    if (PB_TRANSPORT_SHARED_MEMORY != child->transport)
+    {
+        PB_send(user, "ERROR: shared memory transport not set up");
+        success = false;
+    }
+
+    static char shm_message[60001];
+    static char shm_mailbox[60001];
+    memset(shm_message, 's', sizeof(shm_message) - 1);
+    PB_send(child, shm_message);
+    PB_receive(child, shm_mailbox, sizeof(shm_mailbox));
+    if (strcmp(shm_mailbox, shm_message))
+    {
+        PB_send(user, "ERROR: long message not echoed through shared memory");
+        success = false;
+    }
+
+    for (int i = 0; i < SHM_MESSAGES; i++)
+    {
+        PB_send(child, huge_message);
+    }
+    for (int i = 0; i < SHM_MESSAGES; i++)
+    {
+        if (PB_STATUS_OK != PB_receive_timeout(child, huge_mailbox, sizeof(huge_mailbox), 5000) ||
+            strcmp(huge_mailbox, huge_message))
+        {
+            PB_send(user, "ERROR: burst not echoed through shared memory");
+            success = false;
+            break;
+        }
+    }
+
+    PB_send(child, "exit");
+    PB_wait(child);
+    if (PB_STATUS_OK == PB_receive_timeout(child, huge_mailbox, sizeof(huge_mailbox), 5000))
+    {
+        PB_send(user, "ERROR: EOF of a shared memory child not reported");
+        success = false;
+    }
+#endif
+
+    //--------------------------------------------------------------------------
+
+    PB_destroy(child);
+    child = PB_create_framed(PB_TYPE_CHILD, PB_FRAMING_LENGTH_PREFIXED);
+
+    PB_spawn(child, ECHO_FRAMED_COMMAND);
+
+    const char binary[] = {'a', '\0', '\n', 'b', '\r', '\n', (char)0xFF};
+    char binary_mailbox[sizeof(binary)];
+    size_t binary_length = 0;
+
+    PB_send_bytes(child, binary, sizeof(binary));
+    if (PB_STATUS_OK == PB_receive_bytes(child, binary_mailbox, 3, &binary_length) ||
+        sizeof(binary) != binary_length)
+    {
+        PB_send(user, "ERROR: oversized frame not reported");
+        success = false;
+    }
+    if (PB_STATUS_OK != PB_receive_bytes(child, binary_mailbox, sizeof(binary_mailbox), &binary_length) ||
+        sizeof(binary) != binary_length || memcmp(binary, binary_mailbox, sizeof(binary)))
+    {
+        PB_send(user, "ERROR: binary frame not echoed whole");
+        success = false;
+    }
+
+    PB_send(child, "framed text");
+    PB_receive(child, buf_in, sizeof(buf_in));
+    if (strcmp(buf_in, "framed text"))
+    {
+        PB_send(user, "ERROR: text over framed process not echoed");
+        success = false;
+    }
+
+    const void *frames[] = {"one", binary, "three"};
+    const size_t frame_lengths[] = {3, sizeof(binary), 5};
+    PB_send_bytes_batch(child, frames, frame_lengths, 3);
+    for (int i = 0; i < 3; i++)
+    {
+        if (PB_STATUS_OK != PB_receive_bytes(child, binary_mailbox, sizeof(binary_mailbox), &binary_length) ||
+            frame_lengths[i] != binary_length || memcmp(frames[i], binary_mailbox, binary_length))
+        {
+            PB_send(user, "ERROR: framed batch not echoed in order");
+            success = false;
+            break;
+        }
+    }
+
+#ifndef _WIN32
+    // Raw sends behind coalesced frames: each header still precedes its bytes.
+    enum { FRAMED_PAGE = 4096 };
+    PB_set_flush_policy(child, PB_FLUSH_COALESCE);
+    PB_send_bytes(child, "queued", 6);
+    FILE *framed_input = tmpfile();
+    fputs("hello", framed_input);
+    fflush(framed_input);
+    PB_status_t file_status = PB_send_file(child, fileno(framed_input), 0, 5);
+    fclose(framed_input);
+    char *framed_page = (char *)aligned_alloc(FRAMED_PAGE, FRAMED_PAGE);
+    memset(framed_page, 'f', FRAMED_PAGE);
+    PB_status_t pages_status = PB_send_pages(child, framed_page, FRAMED_PAGE);
+    PB_set_flush_policy(child, PB_FLUSH_IMMEDIATE);
+
+    static char framed_mailbox[FRAMED_PAGE];
+    const void *raw_expected[] = {"queued", "hello", framed_page};
+    const size_t raw_lengths[] = {6, 5, FRAMED_PAGE};
+    bool raw_ok = PB_STATUS_OK == file_status && PB_STATUS_OK == pages_status;
+    for (int i = 0; i < 3 && raw_ok; i++)
+    {
+        raw_ok = PB_STATUS_OK == PB_receive_bytes_timeout(child, framed_mailbox, sizeof(framed_mailbox), &binary_length, 5000) &&
+                 raw_lengths[i] == binary_length && 0 == memcmp(raw_expected[i], framed_mailbox, binary_length);
+    }
+    if (!raw_ok)
+    {
+        PB_send(user, "ERROR: PB_send_file/PB_send_pages on a coalescing framed process not echoed");
+        success = false;
+    }
+    free(framed_page); // only once the child has read it
+#endif
+
+    PB_send_bytes(child, "exit", 4);
+    PB_wait(child);
+
+    //--------------------------------------------------------------------------
+
+    // The child answers in pairs, in reverse order: ids must match them back.
+    enum { PIPELINED = 10 };
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_spawn(child, ECHO_TAGGED_COMMAND);
+
+    int pipelined[PIPELINED];
+    for (int i = 0; i < PIPELINED; i++)
+    {
+        pipelined[i] = i;
+        snprintf(buf_out, sizeof(buf_out), "req%d", i);
+        PB_request(child, buf_out, check_response, &pipelined[i], NULL);
+    }
+    while (0 != PB_requests_in_flight(child))
+    {
+        if (PB_STATUS_OK != PB_poll_responses(child, 5000))
+        {
+            break;
+        }
+    }
+    for (int i = 0; i < PIPELINED; i++)
+    {
+        if (-1 != pipelined[i])
+        {
+            PB_send(user, "ERROR: pipelined responses not matched to their requests");
+            success = false;
+            break;
+        }
+    }
+
+    PB_send_tagged(child, 0, "exit", 4);
+    PB_wait(child);
+
+    //--------------------------------------------------------------------------
+
+    // A crash hands the unanswered requests back and a new child takes over.
+    handback_t handback = {0, ""};
+    PB_supervisor_options_t supervisor_options = {"ready", 0, 0, 0, PB_FRAMING_TEXT, collect_handback, &handback};
+    PB_supervisor_t *supervisor = PB_supervisor_create(SERVE_COMMAND, &supervisor_options);
+    PB_supervisor_poll(supervisor, 5000);
+    int supervised[3] = {0, 1, 2};
+    PB_process_t *serving = PB_supervisor_process(supervisor);
+    if (NULL != serving)
+    {
+        PB_request(serving, "req0", check_response, &supervised[0], NULL);
+        PB_request(serving, "crash", check_response, &supervised[1], NULL);
+    }
+    for (int i = 0; i < 100 && (0 == PB_supervisor_restarts(supervisor) || NULL == PB_supervisor_process(supervisor)); i++)
+    {
+        PB_supervisor_poll(supervisor, 50);
+    }
+    serving = PB_supervisor_process(supervisor);
+    if (NULL != serving)
+    {
+        PB_request(serving, "req2", check_response, &supervised[2], NULL);
+        while (0 != PB_requests_in_flight(serving) && PB_STATUS_OK == PB_supervisor_poll(supervisor, 5000))
+        {
+        }
+    }
+    if (-1 != supervised[0] || -1 != supervised[2] || 1 != handback.count || strcmp(handback.last, "crash") ||
+        1 != PB_supervisor_restarts(supervisor))
+    {
+        PB_send(user, "ERROR: supervisor did not replace the crashed child");
+        success = false;
+    }
+    PB_supervisor_destroy(supervisor);
+
+#ifndef _WIN32
+    //--------------------------------------------------------------------------
+
+    // Several threads share one child through the I/O thread.
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_spawn(child, SERVE_COMMAND);
+    PB_receive(child, buf_in, sizeof(buf_in)); // "ready"
+    PB_threaded_t *threaded = PB_threaded_create(child);
+    pthread_t callers_threads[CALLING_THREADS];
+    caller_t callers[CALLING_THREADS];
+    for (int i = 0; i < CALLING_THREADS; i++)
+    {
+        callers[i].threaded = threaded;
+        callers[i].thread_index = i;
+        callers[i].answered = 0;
+        pthread_create(&callers_threads[i], NULL, call_many, &callers[i]);
+    }
+    for (int i = 0; i < CALLING_THREADS; i++)
+    {
+        pthread_join(callers_threads[i], NULL);
+        if (CALLS_PER_THREAD != callers[i].answered)
+        {
+            PB_send(user, "ERROR: threaded calls not all answered");
+            success = false;
+        }
+    }
+    PB_threaded_destroy(threaded);
+    PB_send_tagged(child, 0, "crash", 5);
+    PB_wait(child);
+#endif
+
+    //--------------------------------------------------------------------------
+
+    // Standby children come out past their handshake, replacements follow.
+    PB_warm_t *warm = PB_warm_create(2, "ready", 5000);
+    PB_warm_prepare(warm, ECHO_READY_COMMAND);
+    for (int i = 0; i < 3; i++)
+    {
+        PB_process_t *warm_child = PB_acquire_warm(warm, ECHO_READY_COMMAND);
+        if (NULL == warm_child || PB_STATUS_OK != PB_send(warm_child, "warm") ||
+            PB_STATUS_OK != PB_receive_timeout(warm_child, buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, "warm"))
+        {
+            PB_send(user, "ERROR: PB_acquire_warm child did not answer");
+            success = false;
+        }
+        if (NULL != warm_child)
+        {
+            PB_send(warm_child, "exit");
+            PB_wait(warm_child);
+            PB_destroy(warm_child);
+        }
+    }
+    PB_warm_destroy(warm);
+
+    // Children that never print the ready line are given up on, not waited for.
+    warm = PB_warm_create(1, "ready", 100);
+    PB_warm_prepare(warm, ECHO_COMMAND);
+    if (NULL != PB_acquire_warm(warm, ECHO_COMMAND))
+    {
+        PB_send(user, "ERROR: PB_acquire_warm handed out a child without handshake");
+        success = false;
+    }
+    PB_warm_destroy(warm);
+
+#ifndef _WIN32
+    //--------------------------------------------------------------------------
+
+    // Children forked by a zygote talk and exit like spawned ones.
+    enum { ZYGOTE_CHILDREN = 3 };
+    PB_zygote_t *zygote = PB_zygote_create(ECHO_ZYGOTE_COMMAND);
+    PB_process_t *forked[ZYGOTE_CHILDREN];
+    for (int i = 0; i < ZYGOTE_CHILDREN; i++)
+    {
+        forked[i] = PB_create(PB_TYPE_CHILD);
+        if (PB_STATUS_OK != PB_spawn_from_zygote(zygote, forked[i]))
+        {
+            PB_send(user, "ERROR: PB_spawn_from_zygote failed");
+            PB_send(user, forked[i]->error);
+            success = false;
+        }
+    }
+    for (int i = 0; i < ZYGOTE_CHILDREN; i++)
+    {
+        snprintf(buf_out, sizeof(buf_out), "forked %d", i);
+        if (PB_STATUS_OK != PB_send(forked[i], buf_out) ||
+            PB_STATUS_OK != PB_receive_timeout(forked[i], buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, buf_out))
+        {
+            PB_send(user, "ERROR: zygote child did not answer");
+            success = false;
+        }
+    }
+    for (int i = ZYGOTE_CHILDREN - 1; i >= 0; i--)
+    {
+        PB_send(forked[i], "exit");
+        if (PB_STATUS_OK != PB_wait(forked[i]) || 0 != forked[i]->return_code)
+        {
+            PB_send(user, "ERROR: zygote child not reaped");
+            success = false;
+        }
+        PB_destroy(forked[i]);
+    }
+    PB_zygote_destroy(zygote);
+
+    // The stderr ring of a forked child is drained like a spawned one's.
+    zygote = PB_zygote_create(FLOOD_STDERR_ZYGOTE_COMMAND);
+    forked[0] = PB_create(PB_TYPE_CHILD);
+    PB_set_stderr_ring(forked[0], 16);
+    if (PB_STATUS_OK != PB_spawn_from_zygote(zygote, forked[0]) ||
+        PB_STATUS_OK != PB_receive_timeout(forked[0], buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, "done"))
+    {
+        PB_send(user, "ERROR: stderr flood blocked the zygote child");
+        success = false;
+    }
+    PB_wait(forked[0]);
+    PB_destroy(forked[0]);
+    PB_zygote_destroy(zygote);
+
+    //--------------------------------------------------------------------------
+
+    // Waiting with a timeout, exit observed through the pidfd.
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_spawn(child, ECHO_COMMAND);
+    if (PB_STATUS_TIMEOUT != PB_wait_timeout(child, 20) || PB_STATUS_WOULD_BLOCK != PB_poll_exit(child))
+    {
+        PB_send(user, "ERROR: running child reported as exited");
+        success = false;
+    }
+    PB_send(child, "exit");
+#ifdef __linux__
+    struct pollfd exit_pfd = {PB_exit_fd(child), POLLIN, 0};
+    if (-1 != exit_pfd.fd && 1 != poll(&exit_pfd, 1, 5000))
+    {
+        PB_send(user, "ERROR: exit fd not readable after the child exited");
+        success = false;
+    }
+#endif
+    if (PB_STATUS_OK != PB_wait_timeout(child, 5000) || 0 != child->return_code || PB_STATUS_OK != PB_poll_exit(child))
+    {
+        PB_send(user, "ERROR: PB_wait_timeout did not reap the child");
+        success = false;
+    }
+
+    //--------------------------------------------------------------------------
+
+    // A child flooding stderr still reaches stdout; the ring keeps the tail
+    // (the drain may still be running while we read, so count both).
+    PB_destroy(child);
+    child = PB_create(PB_TYPE_CHILD);
+    PB_set_stderr_ring(child, 16);
+    PB_spawn(child, FLOOD_STDERR_COMMAND);
+    if (PB_STATUS_OK != PB_receive_timeout(child, buf_in, sizeof(buf_in), 5000) || strcmp(buf_in, "done"))
+    {
+        PB_send(user, "ERROR: stderr flood blocked the child");
+        success = false;
+    }
+    PB_wait(child);
+    int ring_lines = 0;
+    while (PB_STATUS_OK == PB_receive_err_timeout(child, buf_in, sizeof(buf_in), 5000))
+    {
+        ring_lines++;
+    }
+    if (ring_lines < 16 || 0 != strncmp(buf_in, "log line 1999 ", 14) || 2000 != ring_lines + (int)PB_stderr_dropped(child))
+    {
+        PB_send(user, "ERROR: stderr ring does not hold the last lines");
+        success = false;
+    }
+#endif
+
+    //--------------------------------------------------------------------------
+
     if (success)
     {
         PB_send(user, "All tests passed successfully.");